@@ -1,34 +1,759 @@
+// mmapのMAP_ANONYMOUSとmadviseを使う
+#define _DEFAULT_SOURCE
+
 #include "9cc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// --statsなどコンパイルごとに変えられるオプション
+// 入力ごとのCtxへinit_optionsでコピーする
+static Ctx defaults;
+
+// --serverが指定された場合、コンパイルサーバとして動く
+static bool opt_server;
+static char *opt_server_path;
+
+// -jで指定された同時にコンパイルするスレッド数
+static int opt_jobs = 1;
+
+// --max-depthで指定された文と式のネストの深さの上限
+static int opt_max_depth = 1 << 22;
+
+// --pipelineが指定された場合、パースしながら関数ごとに-j個のスレッドでコード生成する
+static bool opt_pipeline;
+
+// --interpが指定された場合、アセンブリを出力せずにmain()を実行し、その戻り値で終了する
+static bool opt_interp;
+
+// --fuelで指定された--interpで実行できるノードの数の上限
+static long opt_fuel = 1L << 27;
+
+// --streamが指定された場合、関数を1つずつパースしてはアセンブリを出力し、その関数のメモリを解放する
+static bool opt_stream;
+
+// 複数の入力ファイルをコンパイルする場合の入力と、次に処理する入力の番号
+static char **inputs;
+static int ninputs;
+static atomic_int next_input;
+
+// コンパイルに失敗した入力ファイルがあればtrue
+static atomic_bool failed;
+
+static void usage(char *argv0) {
+  error("usage: %s [--stats[=text|json]] [--remarks[=text|json]] [--callgraph-report] [--frame-report] [--fold]\n"
+        "          [--pipeline] [-j N] [--max-depth=N] [--whole-program [--export=NAME[,NAME...]]] <program | file.c... | ->\n"
+        "       %s [--stats[=text|json]] [--remarks[=text|json]] [--frame-report] [-j N] [--max-depth=N]\n"
+        "          --stream <program | file.c... | ->\n"
+        "       %s [--stats[=text|json]] [--fold] [--max-depth=N] [--fuel=N] --interp <program | file.c | ->\n"
+        "       %s [--remarks[=text|json]] [--frame-report] [--fold] [--pipeline] [-j N] [--max-depth=N]\n"
+        "          [--whole-program [--export=NAME[,NAME...]]] --server[=socket-path]", argv0, argv0, argv0, argv0);
+}
+
+// pathのファイルの中身を読み込んで返す。"-"の場合は標準入力から読む
+// 開けないか読めない場合はerrnoを設定してNULLを返す
+static char *read_file(char *path) {
+  FILE *fp = stdin;
+  if (strcmp(path, "-")) {
+    fp = fopen(path, "r");
+    if (!fp)
+      return NULL;
+  }
+
+  int cap = 4096;
+  int len = 0;
+  char *buf = malloc(cap);
+  for (;;) {
+    int n = fread(buf + len, 1, cap - len - 1, fp);
+    if (n == 0)
+      break;
+    len += n;
+    if (cap - len == 1) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  int err = ferror(fp) ? errno : 0;
+  if (fp != stdin)
+    fclose(fp);
+  if (err) {
+    free(buf);
+    errno = err;
+    return NULL;
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+// pathのファイルを読み出し専用でmmapしてctx->user_inputにする。"-"の場合はread_fileで読む
+// 読み終えた部分はmadviseで捨てられるので、大きなファイルでも入力全体がメモリに載らない
+// 開けないかmmapできない場合はerrnoを設定してfalseを返す
+static bool map_file(Ctx *ctx, char *path) {
+  if (!strcmp(path, "-"))
+    return (ctx->user_input = read_file(path)) != NULL;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+
+  // ファイルの後ろに無名のページを1つ足して、入力の終わりの'\0'にする
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (st.st_size / page + 1) * page;
+  char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED ||
+      (st.st_size && mmap(buf, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+    int err = errno;
+    if (buf != MAP_FAILED)
+      munmap(buf, size);
+    close(fd);
+    errno = err;
+    return false;
+  }
+  close(fd);
+
+  ctx->user_input = buf;
+  ctx->input_mapped = size;
+  return true;
+}
+
+// --streamならmap_file、そうでなければread_fileでpathを読み込む。失敗した場合はfalseを返す
+static bool load_input(Ctx *ctx, char *path) {
+  if (opt_stream)
+    return map_file(ctx, path);
+  return (ctx->user_input = read_file(path)) != NULL;
+}
+
+// read_fileかmap_fileで読み込んだ入力を解放する
+static void free_input(Ctx *ctx) {
+  if (ctx->input_mapped)
+    munmap(ctx->user_input, ctx->input_mapped);
+  else
+    free(ctx->user_input);
+}
+
+// 引数が"-"か".c"で終わるファイル名ならtrue
+static bool is_file_arg(char *arg) {
+  int len = strlen(arg);
+  return !strcmp(arg, "-") || (len > 2 && !strcmp(arg + len - 2, ".c"));
+}
+
+// foo.cの出力先のfoo.sを返す
+static char *output_path(char *path) {
+  int len = strlen(path);
+  char *buf = malloc(len + 1);
+  strcpy(buf, path);
+  buf[len - 1] = 's';
+  return buf;
+}
+
+// パイプラインモードでコード生成を待つ関数
+typedef struct Job Job;
+struct Job {
+  _Atomic(Job *) next;
+  Function *fn;
+  char *buf;  // 生成したアセンブリ
+  size_t len;
+};
+
+// パースするスレッドが1つだけ書き込み、コード生成するスレッドが取り出すロックフリーのキュー
+// キューが空の間、コード生成のスレッドはreadyで眠り、enqueueとfinish_jobsが起こす
+typedef struct {
+  _Atomic(Job *) head; // 最後に取り出されたジョブ。最初は番兵
+  atomic_bool done;    // 全ての関数をキューに入れたらtrue
+  Ctx *ctx;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  atomic_int nwaiting; // readyで眠っている（眠ろうとしている）スレッドの数
+  int nqueued;         // 全てのスレッドが眠ってから追加したジョブの数。パースするスレッドだけが使う
+
+  pthread_t *threads;  // コード生成のスレッド。start_workersで作る
+  int nthreads;
+} JobQueue;
+
+// 眠っているスレッドを1つ起こす
+static void wake_worker(JobQueue *q) {
+  pthread_mutex_lock(&q->lock);
+  pthread_cond_signal(&q->ready);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// キューが空でdoneでもなければ、enqueueかfinish_jobsに起こされるまで眠る
+// nwaitingを増やしてからキューを調べ、enqueueはジョブをつないでからnwaitingを調べるので、
+// どちらかが必ず相手に気づく。起こす側はlockを取るので、眠る前に起こされることはない
+static void wait_for_job(JobQueue *q) {
+  pthread_mutex_lock(&q->lock);
+  atomic_fetch_add(&q->nwaiting, 1);
+  Job *head = atomic_load(&q->head);
+  if (!atomic_load(&head->next) && !atomic_load(&q->done))
+    pthread_cond_wait(&q->ready, &q->lock);
+  atomic_fetch_sub(&q->nwaiting, 1);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// キューからジョブを1つ取り出す。全てのジョブを取り出し終わったらNULLを返す
+static Job *pop_job(JobQueue *q) {
+  for (;;) {
+    // doneを先に読むので、doneがtrueならその時点で全てのジョブが見えている
+    bool done = atomic_load(&q->done);
+    Job *head = atomic_load(&q->head);
+    Job *next = atomic_load(&head->next);
+    if (next) {
+      if (!atomic_compare_exchange_weak(&q->head, &head, next))
+        continue;
+      // まだジョブが残っていれば、眠っているスレッドを順に起こして手伝わせる
+      if (atomic_load(&next->next) && atomic_load(&q->nwaiting) > 0)
+        wake_worker(q);
+      return next;
+    }
+    if (done)
+      return NULL;
+    wait_for_job(q);
+  }
+}
+
+// キューの関数のアセンブリをそれぞれのバッファへ生成する
+// ラベルの通し番号や出力先はスレッドごとのCtxのコピーに持つ
+static void *codegen_worker(void *arg) {
+  JobQueue *q = arg;
+  Ctx ctx = *q->ctx;
+
+  for (Job *job; (job = pop_job(q)); ) {
+    ctx.out = open_memstream(&job->buf, &job->len);
+    codegen_function(&ctx, job->fn);
+    fclose(ctx.out);
+  }
+  return NULL;
+}
+
+// opt_jobs個のコード生成のスレッドを作る
+static void start_workers(JobQueue *q) {
+  q->threads = calloc(opt_jobs, sizeof(pthread_t));
+  for (; q->nthreads < opt_jobs; q->nthreads++)
+    if (pthread_create(&q->threads[q->nthreads], NULL, codegen_worker, q))
+      error("cannot create a thread");
+}
+
+// コード生成のスレッドの終了を待ち、outがあればジョブのアセンブリをソースの順に書き出す
+static void finish_jobs(JobQueue *q, Job *head, FILE *out) {
+  atomic_store(&q->done, true);
+  pthread_mutex_lock(&q->lock);
+  pthread_cond_broadcast(&q->ready);
+  pthread_mutex_unlock(&q->lock);
+
+  for (int i = 0; i < q->nthreads; i++)
+    pthread_join(q->threads[i], NULL);
+  free(q->threads);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->ready);
+
+  for (Job *job = atomic_load(&head->next); job; ) {
+    if (out)
+      fwrite(job->buf, 1, job->len, out);
+    Job *next = atomic_load(&job->next);
+    free(job->buf);
+    free(job);
+    job = next;
+  }
+}
+
+// 全てのスレッドが眠っている間は、ジョブがこの数だけたまってから起こす
+// 関数ごとに起こすと、コード生成より起こす方に時間がかかる
+#define WAKE_BATCH 16
+
+// キューの末尾*tailへfnのジョブを追加する
+// 全てのスレッドが眠っていて、ジョブがWAKE_BATCH個たまった場合だけ1つ起こす。
+// 起きているスレッドがあれば、そのスレッドがジョブを取り出すか、眠る前にジョブに気づく。
+// たまったままのジョブはfinish_jobsで起こして処理する
+static void enqueue(JobQueue *q, Job **tail, Function *fn) {
+  Job *job = calloc(1, sizeof(Job));
+  job->fn = fn;
+  atomic_store(&(*tail)->next, job);
+  *tail = job;
+
+  if (atomic_load(&q->nwaiting) < q->nthreads) {
+    q->nqueued = 0;
+    return;
+  }
+  if (++q->nqueued >= WAKE_BATCH) {
+    q->nqueued = 0;
+    wake_worker(q);
+  }
+}
+
+// --callgraph-reportで、呼び出しグラフをprogの関数ごとに出力する
+static void print_callgraphs(Ctx *ctx, Function *prog) {
+  for (Function *fn = prog; fn; fn = fn->next)
+    print_callgraph(ctx, fn, ctx->report);
+}
+
+// 呼び出しグラフが必要なら作り、変数のoffsetを割り当てる。
+// --foldなら定数の引数での呼び出しを評価し、--whole-programなら使われない関数を取り除いたリストを返す
+static Function *analyze(Ctx *ctx, Function *prog) {
+  // 呼び出しグラフを使うのはインタプリタと関数の削除、--callgraph-report、--remarksだけで、コード生成には要らない
+  if (ctx->opt.fold || ctx->opt.whole_program || ctx->opt.callgraph_report || ctx->opt.remarks || opt_interp) {
+    phase_begin(ctx, PH_CALLGRAPH);
+    build_callgraph(ctx, prog);
+    phase_end(ctx, PH_CALLGRAPH);
+  }
+
+  phase_begin(ctx, PH_OFFSET);
+  for (Function *fn=prog; fn; fn=fn->next)
+    assign_offsets(ctx, fn);
+  phase_end(ctx, PH_OFFSET);
+
+  if (ctx->opt.fold) {
+    phase_begin(ctx, PH_FOLD);
+    fold_calls(ctx, prog);
+    phase_end(ctx, PH_FOLD);
+  }
+
+  if (ctx->opt.whole_program) {
+    phase_begin(ctx, PH_CALLGRAPH);
+    if (ctx->opt.fold)
+      build_callgraph(ctx, prog); // 評価した呼び出しは呼び出しグラフから消える
+    prog = remove_dead_functions(ctx, prog, ctx->opt.exports, ctx->opt.nexports);
+    phase_end(ctx, PH_CALLGRAPH);
+  }
+
+  if (ctx->opt.callgraph_report)
+    print_callgraphs(ctx, prog);
+  return prog;
+}
+
+// コード生成の終わったprogの関数と、取り除いた関数のRemarkを出力する
+static void print_program_remarks(Ctx *ctx, Function *prog) {
+  for (Function *fn = prog; fn; fn = fn->next)
+    print_remarks(ctx, fn, ctx->report, ctx->opt.remarks_json);
+  print_removed(ctx, ctx->report, ctx->opt.remarks_json);
+}
+
+// 関数を1つパースするごとにキューへ入れ、opt_jobs個のスレッドで並列にコード生成する
+// 生成したアセンブリはソースの順に出力するので、出力は通常のモードと同じになる
+// --whole-programと--foldの場合は全ての関数をパースするまで呼び出し先がわからないので、
+// パースと解析が終わってからスレッドを作り、残った関数をキューへ入れる
+static void compile_pipelined(Ctx *ctx) {
+  Job head = {0};
+  JobQueue q = {0};
+  atomic_store(&q.head, &head);
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.ready, NULL);
+
+  // パース中にctxは書き換わるので、コード生成のスレッドには開始前のコピーを渡す
+  Ctx snapshot = *ctx;
+  q.ctx = &snapshot;
+
+  bool whole = ctx->opt.whole_program || ctx->opt.fold;
+  if (!whole)
+    start_workers(&q);
+
+  // パースエラーから回復する場合は、スレッドを止めてから呼び出し元へ戻る
+  jmp_buf *outer = ctx->on_error;
+  jmp_buf buf;
+  if (outer) {
+    if (setjmp(buf)) {
+      ctx->on_error = outer;
+      finish_jobs(&q, &head, NULL);
+      longjmp(*outer, 1);
+    }
+    ctx->on_error = &buf;
+  }
+
+  phase_begin(ctx, PH_PARSE);
+  Job *tail = &head;
+  Function prog = {0};
+  Function *cur = &prog;
+  for (Function *fn; (fn = next_function(ctx)); ) {
+    cur = cur->next = fn;
+    if (whole)
+      continue;
+    assign_offsets(ctx, fn);
+    if (ctx->opt.frame_report)
+      print_frame(ctx, fn, ctx->report);
+    enqueue(&q, &tail, fn);
+  }
+  phase_end(ctx, PH_PARSE);
+
+  if (whole) {
+    prog.next = analyze(ctx, prog.next);
+    start_workers(&q);
+    for (Function *fn = prog.next; fn; fn = fn->next) {
+      if (ctx->opt.frame_report)
+        print_frame(ctx, fn, ctx->report);
+      enqueue(&q, &tail, fn);
+    }
+  }
+  ctx->on_error = outer;
+
+  // コード生成の終わりを待って、ソースの順に書き出す
+  phase_begin(ctx, PH_CODEGEN);
+  codegen_header(ctx);
+  finish_jobs(&q, &head, ctx->out);
+  fflush(ctx->out);
+  phase_end(ctx, PH_CODEGEN);
+
+  // パースしながら生成した場合は、コード生成が終わってから呼び出しグラフを作る
+  // --remarksも再帰呼び出しを示すために呼び出しグラフを使う
+  if (!whole && (ctx->opt.callgraph_report || ctx->opt.remarks)) {
+    phase_begin(ctx, PH_CALLGRAPH);
+    build_callgraph(ctx, prog.next);
+    phase_end(ctx, PH_CALLGRAPH);
+    if (ctx->opt.callgraph_report)
+      print_callgraphs(ctx, prog.next);
+  }
+  if (ctx->opt.remarks)
+    print_program_remarks(ctx, prog.next);
+}
+
+// コマンドライン引数で指定されたオプションをctxへ設定する
+// --stats, --callgraph-report, --frame-report, --remarksは標準エラー出力へ書き出す
+void init_options(Ctx *ctx) {
+  ctx->opt = defaults.opt;
+  ctx->report = stderr;
+}
+
+// argがコンパイルごとのオプションならctx->optへ設定してtrueを返す
+// --exportの関数名はargを書き換えて取り出すので、argはコンパイルが終わるまで残しておくこと
+bool parse_option(Ctx *ctx, char *arg) {
+  Options *opt = &ctx->opt;
+  if (!strcmp(arg, "--stats") || !strcmp(arg, "--stats=text")) {
+    opt->stats = true;
+    opt->stats_json = false;
+    return true;
+  }
+  if (!strcmp(arg, "--stats=json")) {
+    opt->stats = opt->stats_json = true;
+    return true;
+  }
+  if (!strcmp(arg, "--remarks") || !strcmp(arg, "--remarks=text")) {
+    opt->remarks = true;
+    opt->remarks_json = false;
+    return true;
+  }
+  if (!strcmp(arg, "--remarks=json")) {
+    opt->remarks = opt->remarks_json = true;
+    return true;
+  }
+  if (!strcmp(arg, "--callgraph-report")) {
+    opt->callgraph_report = true;
+    return true;
+  }
+  if (!strcmp(arg, "--fold")) {
+    opt->fold = true;
+    return true;
+  }
+  if (!strcmp(arg, "--frame-report")) {
+    opt->frame_report = true;
+    return true;
+  }
+  if (!strcmp(arg, "--whole-program")) {
+    opt->whole_program = true;
+    return true;
+  }
+  if (!strncmp(arg, "--export=", 9)) {
+    // 元の配列はinit_optionsでコピーしたものかもしれないので、書き換えずに新しく作る
+    int n = opt->nexports + 1;
+    for (char *p = arg + 9; *p; p++)
+      n += *p == ',';
+    char **exports = new_obj(ctx, AL_STRING, n * sizeof(char *));
+    memcpy(exports, opt->exports, opt->nexports * sizeof(char *));
+    opt->exports = exports;
+
+    char *save;
+    for (char *name = strtok_r(arg + 9, ",", &save); name; name = strtok_r(NULL, ",", &save))
+      opt->exports[opt->nexports++] = name;
+    return true;
+  }
+  return false;
+}
+
+// トークンを必要になった時に読みながら関数を1つずつパースし、アセンブリを出力してから
+// その関数のトークンとノードを解放する。ピークのメモリ使用量は一番大きな関数で決まる
+static void compile_streaming(Ctx *ctx) {
+  phase_begin(ctx, PH_TOKENIZE);
+  ctx->token = tokenize_lazy(ctx);
+  phase_end(ctx, PH_TOKENIZE);
+
+  codegen_header(ctx);
+  ObjMark mark = mark_objs(ctx);
+  for (;;) {
+    phase_begin(ctx, PH_PARSE);
+    Function *fn = next_function(ctx);
+    phase_end(ctx, PH_PARSE);
+    if (!fn)
+      break;
+
+    phase_begin(ctx, PH_OFFSET);
+    assign_offsets(ctx, fn);
+    phase_end(ctx, PH_OFFSET);
+    if (ctx->opt.frame_report)
+      print_frame(ctx, fn, ctx->report);
+
+    phase_begin(ctx, PH_CODEGEN);
+    codegen_function(ctx, fn);
+    phase_end(ctx, PH_CODEGEN);
+    if (ctx->opt.remarks)
+      print_remarks(ctx, fn, ctx->report, ctx->opt.remarks_json);
+
+    // 次の関数の最初のトークンだけを残して、この関数のメモリを解放する
+    Token tok = *ctx->token;
+    release_objs(ctx, mark);
+    reset_parser(ctx);
+    ctx->token = new_obj(ctx, AL_TOKEN, sizeof(Token));
+    *ctx->token = tok;
+
+    // 読み終えた入力のページを捨てる
+    if (ctx->input_mapped) {
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t done = (tok.str - ctx->user_input) / page * page;
+      madvise(ctx->user_input, done, MADV_DONTNEED);
+    }
+  }
+  fflush(ctx->out);
+}
+
+// ctx->user_inputをコンパイルしてctx->outへアセンブリを出力する
+// 統計や呼び出しグラフ、フレームの大きさ、リマークはctx->reportへ出力する
+void compile(Ctx *ctx) {
+  ctx->max_depth = opt_max_depth;
+
+  if (opt_stream) {
+    // --streamは関数を1つずつ出力するので、全ての関数を見る必要のあるオプションとは一緒に使えない
+    if (ctx->opt.fold || ctx->opt.whole_program)
+      error_tok(ctx, NULL, "--stream cannot be used with --fold or --whole-program");
+    compile_streaming(ctx);
+    if (ctx->opt.stats)
+      print_stats(ctx, ctx->report, ctx->opt.stats_json);
+    return;
+  }
+
+  phase_begin(ctx, PH_TOKENIZE);
+  ctx->token = tokenize(ctx);        // トークナイズを実行
+  phase_end(ctx, PH_TOKENIZE);
+
+  if (opt_pipeline) {
+    compile_pipelined(ctx);
+  } else {
+    phase_begin(ctx, PH_PARSE);
+    Function *prog = program(ctx);   // 構文解析を実行（パースを実行）
+    phase_end(ctx, PH_PARSE);
+
+    prog = analyze(ctx, prog);
+
+    if (ctx->opt.frame_report)
+      for (Function *fn=prog; fn; fn=fn->next)
+        print_frame(ctx, fn, ctx->report);
+
+    // アセンブリ生成
+    phase_begin(ctx, PH_CODEGEN);
+    codegen(ctx, prog);
+    fflush(ctx->out);
+    phase_end(ctx, PH_CODEGEN);
+
+    if (ctx->opt.remarks)
+      print_program_remarks(ctx, prog);
+  }
+
+  if (ctx->opt.stats)
+    print_stats(ctx, ctx->report, ctx->opt.stats_json);
+}
+
+// ctx->user_inputのmain()をインタプリタで実行して戻り値を返す
+static int interpret(Ctx *ctx) {
+  ctx->max_depth = opt_max_depth;
+
+  phase_begin(ctx, PH_TOKENIZE);
+  ctx->token = tokenize(ctx);
+  phase_end(ctx, PH_TOKENIZE);
+
+  phase_begin(ctx, PH_PARSE);
+  Function *prog = program(ctx);
+  phase_end(ctx, PH_PARSE);
+
+  prog = analyze(ctx, prog);
+
+  phase_begin(ctx, PH_INTERP);
+  long ret = run_main(ctx, prog, opt_fuel);
+  phase_end(ctx, PH_INTERP);
+
+  if (ctx->opt.stats)
+    print_stats(ctx, ctx->report, ctx->opt.stats_json);
+  return ret;
+}
+
+// foo.cをコンパイルしてfoo.sへ出力する
+// エラーがあっても他のファイルのコンパイルは続け、failedをtrueにする
+// 入力や出力のファイルを開けない場合も、プロセスを終了せずにそのファイルだけ失敗とする
+static void compile_file(char *path) {
+  Ctx *ctx = calloc(1, sizeof(Ctx));
+  init_options(ctx);
+  ctx->filename = path;
+  ctx->err = stderr;
+  if (!load_input(ctx, path)) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    atomic_store(&failed, true);
+    free(ctx);
+    return;
+  }
+
+  char *outpath = output_path(path);
+  ctx->out = fopen(outpath, "w");
+  if (!ctx->out) {
+    fprintf(stderr, "%s: %s\n", outpath, strerror(errno));
+    atomic_store(&failed, true);
+    free(outpath);
+    free_input(ctx);
+    free(ctx);
+    return;
+  }
+
+  jmp_buf buf;
+  ctx->on_error = &buf;
+  if (setjmp(buf) == 0) {
+    compile(ctx);
+    fclose(ctx->out);
+  } else {
+    fclose(ctx->out);
+    remove(outpath);
+    atomic_store(&failed, true);
+  }
+
+  free(outpath);
+  free_input(ctx);
+  free_objs(ctx);
+  free(ctx);
+}
+
+// 入力ファイルがなくなるまで1つずつ取り出してコンパイルする
+static void *worker(void *arg) {
+  for (;;) {
+    int i = atomic_fetch_add(&next_input, 1);
+    if (i >= ninputs)
+      return NULL;
+    compile_file(inputs[i]);
+  }
+}
+
+// 複数の入力ファイルをopt_jobs個のスレッドでコンパイルする
+static void compile_files(void) {
+  int nthreads = opt_jobs < ninputs ? opt_jobs : ninputs;
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+
+  for (int i = 0; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, NULL))
+      error("cannot create a thread");
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
 
 /**
  * アセンブリを生成する
- * 
+ *
  * argc: コマンドライン引数の個数
  * **argv: argvはコマンドライン引数を格納した配列
  *          **argvなので配列のポインタ変数のポインタ？
+ *
+ * 入力が1つの場合は標準出力へ、複数のファイルの場合はそれぞれfoo.cからfoo.sへ出力する。
  */
 int main(int argc, char **argv) {
-  if (argc != 2) {
+  inputs = calloc(argc, sizeof(char *));
+
+  for (int i = 1; i < argc; i++) {
+    if (parse_option(&defaults, argv[i]))
+      continue;
+    if (!strcmp(argv[i], "--pipeline")) {
+      opt_pipeline = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--server")) {
+      opt_server = true;
+      continue;
+    }
+    if (!strncmp(argv[i], "--server=", 9)) {
+      opt_server = true;
+      opt_server_path = argv[i] + 9;
+      continue;
+    }
+    if (!strcmp(argv[i], "--stream")) {
+      opt_stream = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--interp")) {
+      opt_interp = true;
+      continue;
+    }
+    if (!strncmp(argv[i], "--fuel=", 7)) {
+      if ((opt_fuel = atol(argv[i] + 7)) < 1)
+        usage(argv[0]);
+      continue;
+    }
+    if (!strncmp(argv[i], "--max-depth=", 12)) {
+      if ((opt_max_depth = atoi(argv[i] + 12)) < 1)
+        usage(argv[0]);
+      continue;
+    }
+    if (!strncmp(argv[i], "-j", 2)) {
+      char *n = argv[i][2] ? argv[i] + 2 : argv[++i];
+      if (!n || (opt_jobs = atoi(n)) < 1)
+        usage(argv[0]);
+      continue;
+    }
+    if (argv[i][0] == '-' && argv[i][1] == '-')
+      usage(argv[0]);
+    inputs[ninputs++] = argv[i];
+  }
+  // --streamは関数を1つずつ出力するので、全ての関数を見る必要のあるモードとは一緒に使えない
+  Options *opt = &defaults.opt;
+  if (opt_stream && (opt_pipeline || opt->fold || opt->whole_program || opt_interp))
+    usage(argv[0]);
+  // --interpはアセンブリを生成しないので、命令を数えられない
+  if (opt_interp && opt->remarks)
+    usage(argv[0]);
+  if (opt_server) {
+    if (ninputs || opt_interp)
+      usage(argv[0]);
+    run_server(opt_server_path);
+    return 0;
+  }
+  if (ninputs == 0) {
     error("%s: invalid number of arguments", argv[0]);
     return 1;
   }
 
-  user_input = argv[1];        // 入力値をグローバル変数へ格納
-  token = tokenize();          // トークナイズを実行
-  Function *prog = program();  // 構文解析を実行（パースを実行）
-
-  for (Function *fn=prog; fn; fn=fn->next) {
-    // nodeを全て回してvariablesの分だけoffsetを生成し、stack_sizeへ格納する
-    int offset = 0;
-    for (VarList *vl=fn->locals; vl; vl=vl->next) {
-      // 変数１つにつき8バイト割り当てるとする
-      offset += 8;
-      vl->var->offset = offset;
-    }
-    fn->stack_size = offset;
+  if (ninputs > 1) {
+    if (opt_interp)
+      usage(argv[0]);
+    for (int i = 0; i < ninputs; i++)
+      if (!strcmp(inputs[i], "-") || !is_file_arg(inputs[i]))
+        error("%s: not a .c file", inputs[i]);
+    compile_files();
+    return atomic_load(&failed);
   }
 
-  // アセンブリ生成
-  codegen(prog);
+  Ctx *ctx = calloc(1, sizeof(Ctx));
+  init_options(ctx);
+  ctx->out = stdout;
+  ctx->err = stderr;
+  if (is_file_arg(inputs[0])) {
+    ctx->filename = inputs[0];
+    if (!load_input(ctx, inputs[0]))
+      error("%s: %s", inputs[0], strerror(errno));
+  } else {
+    ctx->user_input = inputs[0]; // 引数そのものがプログラム
+  }
+  if (opt_interp)
+    return interpret(ctx);
+  compile(ctx);
   return 0;
-}
\ No newline at end of file
+}
@@ -1,10 +1,17 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
+#include <errno.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// コンパイル単位ごとの状態。定義はファイルの末尾
+typedef struct Ctx Ctx;
+
 /**
  * tokenize.c
  */
@@ -26,25 +33,21 @@ struct Token {
   int val;        // kindがTK_NUMの場合、その数値
   char *str;      // トークン文字列
   int len;        // トークンの長さ
+  int line_no;    // 行番号（1から）
 };
 
 void error(char *fmt, ...);
-void error_at(char *loc, char *fmt, ...);
-void error_tok(Token *tok, char *fmt, ...);
-Token *consume(char *op);
-char *my_strndup(char *p, int len);
-Token *consume_ident();
-void expect(char *op);
-int expect_number(void);
-char *expect_ident(void);
-bool at_eof(void);
-Token *tokenize(void);
-
-// 入力プログラム
-extern char *user_input;
-
-// 現在着目しているトークン
-extern Token *token;
+void error_at(Ctx *ctx, char *loc, char *fmt, ...);
+void error_tok(Ctx *ctx, Token *tok, char *fmt, ...);
+Token *consume(Ctx *ctx, char *op);
+char *my_strndup(Ctx *ctx, char *p, int len);
+Token *consume_ident(Ctx *ctx);
+void expect(Ctx *ctx, char *op);
+int expect_number(Ctx *ctx);
+char *expect_ident(Ctx *ctx);
+bool at_eof(Ctx *ctx);
+Token *tokenize(Ctx *ctx);
+Token *tokenize_lazy(Ctx *ctx);
 
 
 /**
@@ -89,6 +92,8 @@ typedef enum {
 } NodeKind;
 
 typedef struct Node Node;
+typedef struct Function Function;
+typedef struct Remark Remark;
 
 // 抽象構文木のノードの型
 struct Node{
@@ -109,25 +114,231 @@ struct Node{
   // 関数を呼び出している場合に使う
   char *funcname;
   Node *args;
+  Function *func; // 呼び出す関数。このファイルに定義がなければNULL（callgraph.cで設定する）
 
   Var *var;      // kindがND_VARの場合のみ使う
   int val;       // kindがND_NUMの場合のみ使う
 };
 
-typedef struct Function Function;
 struct Function {
   Function *next;
   char *name;
+  Token *tok;     // 関数名のトークン
   VarList *params;
   Node *node;
   VarList *locals;
   int stack_size;
+
+  // callgraph.cで設定する
+  Function **callees; // このファイルで定義された関数のうち、呼び出しているもの
+  int ncallees;
+  int scc;            // 強連結成分の番号。同じ番号の関数は互いに呼び出し合う。作る前は-1
+  bool recursive;     // 自分自身を直接または間接的に呼び出すならtrue
+
+  // frame.cで設定する
+  int nlocals;
+  int nslots;         // 変数に割り当てた8バイトのスロットの数
+  char *noshare;      // スロットを共有しなかった場合はその理由
+
+  // interp.cで設定する
+  bool pure;          // ポインタも定義のない関数も使わず、引数だけで戻り値が決まるならtrue
+
+  // codegen.cで数える
+  int ninsns;         // 命令の数（ディレクティブとラベルは除く）
+  int npush, npop;
+  int ncalls;
+  int nalign_checks;  // 呼び出し前にrspが16バイト境界にあるかを実行時に調べる回数
+
+  Remark *remarks;    // 適用した最適化と見送った最適化。ソースの順に並ぶ
 };
 
-Function *program(void);
+// 式と文の解析で使うスタックの要素。定義はparse.c
+typedef struct Op Op;
+typedef struct StmtFrame StmtFrame;
+
+Function *next_function(Ctx *ctx);
+void reset_parser(Ctx *ctx);
+Function *program(Ctx *ctx);
+void walk_nodes(Node *node, void (*visit)(Node *node, void *arg), void *arg);
 
 /**
  * codegen.c
  */
 
- void codegen(Function *prog);
\ No newline at end of file
+void codegen_header(Ctx *ctx);
+void codegen_function(Ctx *ctx, Function *fn);
+void codegen(Ctx *ctx, Function *prog);
+
+/**
+ * callgraph.c
+ */
+
+void build_callgraph(Ctx *ctx, Function *prog);
+Function *remove_dead_functions(Ctx *ctx, Function *prog, char **roots, int nroots);
+void print_callgraph(Ctx *ctx, Function *fn, FILE *out);
+
+/**
+ * frame.c
+ */
+
+void assign_offsets(Ctx *ctx, Function *fn);
+void print_frame(Ctx *ctx, Function *fn, FILE *out);
+
+/**
+ * interp.c
+ */
+
+void fold_calls(Ctx *ctx, Function *prog);
+long run_main(Ctx *ctx, Function *prog, long fuel);
+
+/**
+ * remarks.c
+ */
+
+// 最適化を適用したか見送ったかの記録
+struct Remark {
+  Remark *next;
+  char *pass;   // 最適化の名前
+  bool missed;  // 見送った場合true
+  Token *tok;   // 最適化した、またはしなかった箇所
+  char *msg;
+};
+
+void add_remark(Ctx *ctx, Function *fn, Token *tok, char *pass, bool missed, char *fmt, ...);
+void print_remarks(Ctx *ctx, Function *fn, FILE *out, bool json);
+void print_removed(Ctx *ctx, FILE *out, bool json);
+
+/**
+ * stats.c
+ */
+
+// 統計を取る構造体の種類
+typedef enum {
+  AL_TOKEN,    // Token
+  AL_NODE,     // Node
+  AL_VAR,      // Var
+  AL_VARLIST,  // VarList
+  AL_FUNCTION, // Function
+  AL_STRING,   // 識別子などの文字列
+  AL_STACK,    // 解析に使うスタック
+  AL_CALLGRAPH, // 呼び出しグラフの辺
+  AL_REMARK,   // Remark
+  AL_NKIND,
+} AllocKind;
+
+// コンパイルのフェーズ
+typedef enum {
+  PH_TOKENIZE, // tokenize()
+  PH_PARSE,    // program()
+  PH_CALLGRAPH, // 呼び出しグラフの解析と使われない関数の削除
+  PH_OFFSET,   // 変数のoffset計算
+  PH_FOLD,     // 定数の引数での関数呼び出しの評価
+  PH_INTERP,   // --interpでのmain()の実行
+  PH_CODEGEN,  // codegen()
+  PH_NPHASE,
+} Phase;
+
+// 統計情報
+typedef struct Stats Stats;
+struct Stats {
+  long alloc_count[AL_NKIND]; // 構造体の種類ごとの確保数
+  long alloc_bytes[AL_NKIND]; // 構造体の種類ごとのバイト数
+  long phase_start[PH_NPHASE]; // フェーズの開始時刻（ナノ秒）
+  long phase_ns[PH_NPHASE];    // フェーズの経過時間（ナノ秒）
+};
+
+// new_objで確保するメモリの塊。コンパイルが終わったらまとめて解放する
+typedef struct Chunk Chunk;
+struct Chunk {
+  Chunk *next;
+  size_t used;
+  size_t cap;
+  char buf[];
+};
+
+// new_objで確保したメモリの位置。release_objsでここまで戻せる
+typedef struct {
+  Chunk *chunk;
+  size_t used;
+} ObjMark;
+
+void *new_obj(Ctx *ctx, AllocKind kind, size_t size);
+void free_objs(Ctx *ctx);
+ObjMark mark_objs(Ctx *ctx);
+void release_objs(Ctx *ctx, ObjMark mark);
+void phase_begin(Ctx *ctx, Phase ph);
+void phase_end(Ctx *ctx, Phase ph);
+void print_stats(Ctx *ctx, FILE *out, bool json);
+
+// 最適化と報告の設定。コマンドライン引数で決まり、--serverではリクエストごとに変えられる
+typedef struct {
+  bool fold;          // --fold
+  bool whole_program; // --whole-program
+  char **exports;     // --exportで指定された関数名
+  int nexports;
+  bool callgraph_report; // --callgraph-report
+  bool frame_report;  // --frame-report
+  bool remarks;       // --remarks。trueなら最適化ごとにRemarkを記録する
+  bool remarks_json;
+  bool stats;         // --stats
+  bool stats_json;
+} Options;
+
+/**
+ * コンパイル単位ごとの状態
+ *
+ * 入力1つにつき1つ作り、各フェーズの関数に引き渡す。
+ * グローバル変数を使わないので、複数の入力を別々のスレッドで同時にコンパイルできる。
+ */
+struct Ctx {
+  char *filename;   // 入力ファイル名。コマンドライン引数のプログラムの場合はNULL
+  char *user_input; // 入力プログラム
+  FILE *out;        // アセンブリの出力先
+  FILE *err;        // エラーメッセージの出力先
+  jmp_buf *on_error; // NULLでなければ、エラーを報告した後にプロセスを終了せずここへlongjmpする
+
+  Options opt;
+  FILE *report;     // --stats, --callgraph-report, --frame-report, --remarksの出力先
+  size_t input_mapped; // user_inputがファイルをmmapしたものなら、mmapした大きさ。そうでなければ0
+
+  // tokenize.c, parse.c
+  Token *token;     // 現在着目しているトークン
+  char *tok_pos;    // 次のトークンを読む位置
+  int tok_line;     // tok_posの行番号
+  VarList *locals;  // パース中の関数のローカル変数
+  int max_depth;    // 文と式のネストの深さの上限
+
+  // parse.cで式と文の解析に使うスタック
+  Op *ops;          // 演算子スタック
+  int nops, ops_cap;
+  Node **operands;  // オペランドスタック
+  int noperands, operands_cap;
+  int paren;        // 演算子スタックの一番内側の括弧の位置
+  StmtFrame *frames; // 子の文を待っている文のスタック
+  int nframes, frames_cap;
+
+  // codegen.c
+  int labelseq;     // ラベルの通し番号
+  char *funcname;   // コード生成中の関数名
+  int loc_line;     // 最後に.locで出力した行番号
+  Function *fn;     // コード生成中の関数。命令の数をここに数える
+
+  Function *removed; // --whole-programで取り除いた関数
+
+  Stats stats;
+  Chunk *chunks;    // new_objで確保したメモリ
+};
+
+/**
+ * 9cc.c
+ */
+
+void init_options(Ctx *ctx);
+bool parse_option(Ctx *ctx, char *arg);
+void compile(Ctx *ctx);
+
+/**
+ * server.c
+ */
+
+void run_server(char *path);
\ No newline at end of file
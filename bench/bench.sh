@@ -0,0 +1,81 @@
+#!/bin/bash
+#
+# コンパイル速度のベンチマーク
+#
+# bench/genで生成した合成プログラムを./9cc --stats=jsonで何回かコンパイルし、
+# フェーズごとの時間の中央値と、1秒あたりのコンパイル行数を表示する。
+#
+# usage: bench/bench.sh [--save]
+#   --save  結果をbench/baseline.txtとして保存する
+#   RUNS    環境変数で試行回数を指定する（デフォルト5）
+#
+# bench/baseline.txtがあれば、totalの中央値をそれと比較して表示する。
+
+cd "$(dirname "$0")/.."
+
+RUNS=${RUNS:-5}
+BASELINE=bench/baseline.txt
+RESULT=bench/result.txt
+TMP=bench/tmp.c
+
+# kind n の組
+CASES="funcs 2000
+expr 20000
+nest 1000
+locals 5000
+loops 5000"
+
+# JSONから"name":値 を取り出す
+field() {
+  echo "$1" | sed -n "s/.*\"$2\":\([0-9]*\).*/\1/p"
+}
+
+# 数値のリストの中央値
+median() {
+  tr ' ' '\n' | sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+printf "%-8s %7s %8s %10s %10s %10s %10s %10s %12s\n" \
+  kind n lines "tok(ms)" "parse(ms)" "offset(ms)" "cgen(ms)" "total(ms)" "lines/s" | tee $RESULT
+
+while read kind n; do
+  ./bench/gen $kind $n > $TMP
+  lines=$(wc -l < $TMP)
+
+  tok=; parse=; offset=; codegen=; total=
+  for i in $(seq $RUNS); do
+    json=$(./9cc --stats=json $TMP 2>&1 >/dev/null) || { echo "$kind: compile failed"; exit 1; }
+    tok="$tok $(field "$json" tokenize)"
+    parse="$parse $(field "$json" parse)"
+    offset="$offset $(field "$json" offset)"
+    codegen="$codegen $(field "$json" codegen)"
+    total="$total $(field "$json" total)"
+  done
+
+  tok=$(echo $tok | median)
+  parse=$(echo $parse | median)
+  offset=$(echo $offset | median)
+  codegen=$(echo $codegen | median)
+  total=$(echo $total | median)
+
+  awk -v k=$kind -v n=$n -v l=$lines -v a=$tok -v b=$parse -v c=$offset -v d=$codegen -v t=$total 'BEGIN {
+    printf "%-8s %7d %8d %10.3f %10.3f %10.3f %10.3f %10.3f %12.0f\n",
+      k, n, l, a / 1e6, b / 1e6, c / 1e6, d / 1e6, t / 1e6, l / (t / 1e9)
+  }' | tee -a $RESULT
+done <<< "$CASES"
+
+rm -f $TMP
+
+if [ -f $BASELINE ]; then
+  echo
+  echo "compared with $BASELINE (total):"
+  awk 'NR == FNR { if (FNR > 1) base[$1] = $8; next }
+       FNR > 1 && ($1 in base) {
+         printf "  %-8s %10.3f -> %10.3f ms (%+.1f%%)\n", $1, base[$1], $8, ($8 / base[$1] - 1) * 100
+       }' $BASELINE $RESULT
+fi
+
+if [ "$1" = "--save" ]; then
+  cp $RESULT $BASELINE
+  echo "saved to $BASELINE"
+fi
@@ -0,0 +1,102 @@
+// ベンチマーク用の合成プログラムを生成する
+//
+// usage: gen <kind> <n>
+//   funcs  n個の関数定義と、それらを呼び出すmain
+//   expr   n項からなる長い式
+//   nest   n段にネストしたif/while/for/ブロック
+//   locals n個のローカル変数を持つ関数
+//   loops  n個連続したfor/whileループ
+//
+// 生成したプログラムは標準出力に書き出す。
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void gen_funcs(int n) {
+  for (int i = 0; i < n; i++) {
+    printf("f%d(a, b) {\n", i);
+    printf("  x = a + b * %d;\n", i % 7 + 1);
+    printf("  if (x > %d) return x - b;\n", i);
+    if (i > 0)
+      printf("  return f%d(x, b - 1);\n", i - 1);
+    else
+      printf("  return x;\n");
+    printf("}\n");
+  }
+  printf("main() {\n");
+  for (int i = 0; i < n; i += 16)
+    printf("  s = s + f%d(%d, 2);\n", i, i);
+  printf("  return s;\n}\n");
+}
+
+static void gen_expr(int n) {
+  static char *ops[] = {"+", "-", "*", "/", "==", "!=", "<", "<=", ">", ">="};
+  printf("main() {\n  a = 1;\n  b = 2;\n  return a");
+  for (int i = 0; i < n; i++) {
+    if (i % 8 == 7)
+      printf("\n    ");
+    printf(" %s %s", ops[i % 10], (i % 3) ? "b" : "(a + 1)");
+  }
+  printf(";\n}\n");
+}
+
+static void gen_nest(int n) {
+  static char *open[] = {
+    "if (i < %d) {", "while (i < %d) {", "for (j = 0; j < %d; j = j + 1) {", "{ %d;",
+  };
+  printf("main() {\n  i = 0;\n");
+  for (int i = 0; i < n; i++) {
+    printf("%*s", i % 64, "");
+    printf(open[i % 4], i);
+    printf("\n");
+  }
+  printf("i = i + 1;\n");
+  for (int i = n - 1; i >= 0; i--)
+    printf("%*s}\n", i % 64, "");
+  printf("  return i;\n}\n");
+}
+
+static void gen_locals(int n) {
+  printf("main() {\n");
+  for (int i = 0; i < n; i++)
+    printf("  v%d = %d;\n", i, i);
+  printf("  s = 0;\n");
+  for (int i = 0; i < n; i++)
+    printf("  s = s + v%d;\n", i);
+  printf("  return s;\n}\n");
+}
+
+static void gen_loops(int n) {
+  printf("main() {\n  s = 0;\n");
+  for (int i = 0; i < n; i++) {
+    if (i % 2)
+      printf("  for (i = 0; i < %d; i = i + 1) s = s + i;\n", i);
+    else
+      printf("  i = 0;\n  while (i < %d) { s = s - i; i = i + 1; }\n", i);
+  }
+  printf("  return s;\n}\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <funcs|expr|nest|locals|loops> <n>\n", argv[0]);
+    return 1;
+  }
+
+  int n = atoi(argv[2]);
+  if (!strcmp(argv[1], "funcs"))
+    gen_funcs(n);
+  else if (!strcmp(argv[1], "expr"))
+    gen_expr(n);
+  else if (!strcmp(argv[1], "nest"))
+    gen_nest(n);
+  else if (!strcmp(argv[1], "locals"))
+    gen_locals(n);
+  else if (!strcmp(argv[1], "loops"))
+    gen_loops(n);
+  else {
+    fprintf(stderr, "%s: unknown kind: %s\n", argv[0], argv[1]);
+    return 1;
+  }
+  return 0;
+}
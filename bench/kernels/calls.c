@@ -0,0 +1,14 @@
+main() {
+  s = 0;
+  for (i = 0; i < 10000000; i = i + 1)
+    s = add3(s, i, 1) - i;
+  return s / 100000;
+}
+
+add3(x, y, z) {
+  return add(x, add(y, z));
+}
+
+add(x, y) {
+  return x + y;
+}
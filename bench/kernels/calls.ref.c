@@ -0,0 +1,14 @@
+long add(long x, long y) {
+  return x + y;
+}
+
+long add3(long x, long y, long z) {
+  return add(x, add(y, z));
+}
+
+int main() {
+  long s = 0;
+  for (long i = 0; i < 10000000; i = i + 1)
+    s = add3(s, i, 1) - i;
+  return s / 100000;
+}
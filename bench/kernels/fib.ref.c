@@ -0,0 +1,9 @@
+long fib(long x) {
+  if (x <= 1)
+    return 1;
+  return fib(x - 1) + fib(x - 2);
+}
+
+int main() {
+  return fib(35);
+}
@@ -0,0 +1,7 @@
+main() {
+  s = 0;
+  for (i = 0; i < 5000; i = i + 1)
+    for (j = 0; j < 10000; j = j + 1)
+      s = s + 1;
+  return s / 1000000;
+}
@@ -0,0 +1,12 @@
+main() {
+  a0 = 0; a1 = 0; a2 = 0; a3 = 0;
+  a4 = 0; a5 = 0; a6 = 0; a7 = 0;
+  for (i = 0; i < 3000000; i = i + 1) {
+    p = &a0;
+    for (j = 0; j < 8; j = j + 1) {
+      *p = *p + j;
+      p = p + 8;
+    }
+  }
+  return a7 / 3000000;
+}
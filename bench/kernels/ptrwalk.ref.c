@@ -0,0 +1,11 @@
+int main() {
+  long a[8] = {0};
+  for (long i = 0; i < 3000000; i = i + 1) {
+    long *p = a;
+    for (long j = 0; j < 8; j = j + 1) {
+      *p = *p + j;
+      p = p + 1;
+    }
+  }
+  return a[7] / 3000000;
+}
@@ -0,0 +1,76 @@
+// プログラムを繰り返し実行して、実行時間とサイクル数を測る
+//
+// usage: run <runs> <program>
+//
+// 標準出力に「経過時間の中央値(ns) 最小値(ns) サイクル数の中央値 終了コード」を
+// 1行で書き出す。終了コードが実行ごとに異なる場合はエラーにする。
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+static long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b) {
+  long x = *(long *)a;
+  long y = *(long *)b;
+  return (x > y) - (x < y);
+}
+
+// programを1回実行して終了コードを返す
+static int run_once(char *program) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(program, program, (char *)NULL);
+    perror(program);
+    _exit(127);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status)) {
+    fprintf(stderr, "%s: terminated abnormally\n", program);
+    exit(1);
+  }
+  return WEXITSTATUS(status);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <runs> <program>\n", argv[0]);
+    return 1;
+  }
+
+  int runs = atoi(argv[1]);
+  if (runs < 1)
+    runs = 1;
+  long *ns = calloc(runs, sizeof(long));
+  long *cycles = calloc(runs, sizeof(long));
+  int status = -1;
+
+  for (int i = 0; i < runs; i++) {
+    long t = now_ns();
+    unsigned long long c = __rdtsc();
+    int st = run_once(argv[2]);
+    cycles[i] = __rdtsc() - c;
+    ns[i] = now_ns() - t;
+
+    if (i > 0 && st != status) {
+      fprintf(stderr, "%s: exit code changed: %d -> %d\n", argv[2], status, st);
+      return 1;
+    }
+    status = st;
+  }
+
+  qsort(ns, runs, sizeof(long), cmp_long);
+  qsort(cycles, runs, sizeof(long), cmp_long);
+  printf("%ld %ld %ld %d\n", ns[runs / 2], ns[0], cycles[runs / 2], status);
+  return 0;
+}
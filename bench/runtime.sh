@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# 生成コードの実行速度のベンチマーク
+#
+# bench/kernels/NAME.cを9ccで、同じ処理を普通のCで書いたNAME.ref.cを
+# gcc -O0とgcc -O2でビルドし、bench/runで何回か実行して比較する。
+# 比はクロック周波数の変動の影響を受けにくいサイクル数の中央値で計算する。
+# 終了コードが一致しない場合は9ccの生成コードが間違っているのでエラーにする。
+#
+# usage: bench/runtime.sh [kernel...]
+#   RUNS    環境変数で試行回数を指定する（デフォルト5）
+
+cd "$(dirname "$0")/.."
+
+RUNS=${RUNS:-5}
+TMP=bench/tmp
+KERNELS=${*:-$(ls bench/kernels/*.c | grep -v '\.ref\.c$' | xargs -n1 basename | sed 's/\.c$//')}
+
+printf "%-10s %10s %10s %10s %14s %14s %14s %10s %10s\n" \
+  kernel "9cc(ms)" "O0(ms)" "O2(ms)" "9cc(cycles)" "O0(cycles)" "O2(cycles)" "9cc/O0" "9cc/O2"
+
+for k in $KERNELS; do
+  ./9cc bench/kernels/$k.c > $TMP.s || { echo "$k: 9cc failed"; exit 1; }
+  gcc -o $TMP.9cc $TMP.s 2>/dev/null || { echo "$k: assemble failed"; exit 1; }
+  gcc -O0 -o $TMP.O0 bench/kernels/$k.ref.c || exit 1
+  gcc -O2 -o $TMP.O2 bench/kernels/$k.ref.c || exit 1
+
+  read t9 min9 c9 s9 <<< "$(./bench/run $RUNS $TMP.9cc)"
+  read t0 min0 c0 s0 <<< "$(./bench/run $RUNS $TMP.O0)"
+  read t2 min2 c2 s2 <<< "$(./bench/run $RUNS $TMP.O2)"
+
+  if [ "$s9" != "$s0" ] || [ "$s9" != "$s2" ]; then
+    echo "$k: exit code mismatch: 9cc=$s9 O0=$s0 O2=$s2"
+    exit 1
+  fi
+
+  awk -v k=$k -v a=$t9 -v b=$t0 -v c=$t2 -v x=$c9 -v y=$c0 -v z=$c2 'BEGIN {
+    printf "%-10s %10.2f %10.2f %10.2f %14d %14d %14d %10.2f %10.2f\n",
+      k, a / 1e6, b / 1e6, c / 1e6, x, y, z, x / y, x / z
+  }'
+done
+
+rm -f $TMP.s $TMP.9cc $TMP.O0 $TMP.O2
@@ -0,0 +1,295 @@
+#include "9cc.h"
+
+/**
+ * 呼び出しグラフの解析
+ *
+ * ND_FUNCALLをたどって、関数ごとにこのファイルで定義された関数のうち呼び出しているもの
+ * (callees)を求め、強連結成分に分けて再帰呼び出しする関数を調べる。
+ * --whole-programの場合は、mainと--exportで指定された関数から呼び出されない関数を削除する。
+ * --callgraph-reportの場合は、関数ごとに強連結成分の番号と呼び出し先を出力する。
+ */
+
+// 関数名から関数を引くためのハッシュ表（オープンアドレス法）
+typedef struct {
+  Function **buckets;
+  int cap;
+} FuncMap;
+
+static unsigned hash(char *s) {
+  unsigned h = 2166136261u;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+static FuncMap new_map(Function *prog) {
+  int n = 0;
+  for (Function *fn = prog; fn; fn = fn->next)
+    n++;
+
+  FuncMap map;
+  map.cap = 16;
+  while (map.cap < n * 2)
+    map.cap *= 2;
+  map.buckets = calloc(map.cap, sizeof(Function *));
+
+  for (Function *fn = prog; fn; fn = fn->next) {
+    unsigned i = hash(fn->name) & (map.cap - 1);
+    while (map.buckets[i])
+      i = (i + 1) & (map.cap - 1);
+    map.buckets[i] = fn;
+  }
+  return map;
+}
+
+// nameの関数が入っているbucketsの添字を返す。なければ-1を返す
+// 同じ名前の関数が複数ある場合は最初に定義されたものを返す
+static int find_slot(FuncMap *map, char *name) {
+  for (unsigned i = hash(name) & (map->cap - 1); map->buckets[i]; i = (i + 1) & (map->cap - 1))
+    if (!strcmp(map->buckets[i]->name, name))
+      return i;
+  return -1;
+}
+
+static Function *find_func(FuncMap *map, char *name) {
+  int i = find_slot(map, name);
+  return i < 0 ? NULL : map->buckets[i];
+}
+
+// fnが入っているbucketsの添字を返す
+static int slot_of(FuncMap *map, Function *fn) {
+  unsigned i = hash(fn->name) & (map->cap - 1);
+  while (map->buckets[i] != fn)
+    i = (i + 1) & (map->cap - 1);
+  return i;
+}
+
+// 関数本体の中の呼び出しを集めるときの状態
+typedef struct {
+  Ctx *ctx;
+  FuncMap *map;
+  Function *fn;
+  int cap;
+} CallCollector;
+
+static void collect_call(Node *node, void *arg) {
+  CallCollector *c = arg;
+  if (node->kind != ND_FUNCALL)
+    return;
+
+  // 定義のない関数（外部の関数）は呼び出しグラフに含めない
+  Function *callee = find_func(c->map, node->funcname);
+  node->func = callee;
+  if (!callee)
+    return;
+
+  Function *fn = c->fn;
+  for (int i = 0; i < fn->ncallees; i++)
+    if (fn->callees[i] == callee)
+      return;
+
+  if (fn->ncallees == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 4;
+    Function **p = new_obj(c->ctx, AL_CALLGRAPH, c->cap * sizeof(Function *));
+    if (fn->ncallees)
+      memcpy(p, fn->callees, fn->ncallees * sizeof(Function *));
+    fn->callees = p;
+  }
+  fn->callees[fn->ncallees++] = callee;
+}
+
+// Tarjanのアルゴリズムで強連結成分を求める。
+// 呼び出しの連鎖が長くても再帰しないように、明示的なスタックを使う
+typedef struct {
+  Function *fn;
+  int edge;   // 次に調べるcalleesの番号
+} SccFrame;
+
+typedef struct {
+  int index;
+  int lowlink;
+  bool on_stack;
+  int scc;
+} SccInfo;
+
+static void find_sccs(Function **funcs, int n) {
+  SccInfo *info = calloc(n, sizeof(SccInfo));
+  Function **stack = calloc(n, sizeof(Function *));
+  SccFrame *frames = calloc(n, sizeof(SccFrame));
+  int nstack = 0;
+  int index = 1;
+  int nscc = 0;
+
+  // 関数の番号は一時的にsccに入れておく
+  for (int i = 0; i < n; i++)
+    funcs[i]->scc = i;
+
+  for (int root = 0; root < n; root++) {
+    if (info[root].index)
+      continue;
+
+    int nframes = 0;
+    frames[nframes++] = (SccFrame){funcs[root], 0};
+    while (nframes > 0) {
+      SccFrame *f = &frames[nframes - 1];
+      SccInfo *v = &info[f->fn->scc];
+
+      if (f->edge == 0 && !v->index) {
+        v->index = v->lowlink = index++;
+        v->on_stack = true;
+        stack[nstack++] = f->fn;
+      }
+
+      if (f->edge < f->fn->ncallees) {
+        Function *callee = f->fn->callees[f->edge++];
+        SccInfo *w = &info[callee->scc];
+        if (!w->index)
+          frames[nframes++] = (SccFrame){callee, 0};
+        else if (w->on_stack && w->index < v->lowlink)
+          v->lowlink = w->index;
+        continue;
+      }
+
+      // f->fnが強連結成分の根なら、スタックから成分を取り出す
+      if (v->lowlink == v->index) {
+        Function *w;
+        int size = 0;
+        Function **members = &stack[nstack];
+        do {
+          w = stack[--nstack];
+          info[w->scc].on_stack = false;
+          members--;
+          size++;
+        } while (w != f->fn);
+
+        for (int i = 0; i < size; i++) {
+          Function *m = members[i];
+          m->recursive = size > 1;
+          for (int j = 0; j < m->ncallees; j++)
+            if (m->callees[j] == m)
+              m->recursive = true;
+        }
+        for (int i = 0; i < size; i++)
+          info[members[i]->scc].scc = nscc;
+        nscc++;
+      }
+
+      nframes--;
+      if (nframes > 0) {
+        SccInfo *parent = &info[frames[nframes - 1].fn->scc];
+        if (v->lowlink < parent->lowlink)
+          parent->lowlink = v->lowlink;
+      }
+    }
+  }
+
+  for (int i = 0; i < n; i++)
+    funcs[i]->scc = info[i].scc;
+
+  free(info);
+  free(stack);
+  free(frames);
+}
+
+// 全ての関数のcallees, scc, recursiveを設定する
+void build_callgraph(Ctx *ctx, Function *prog) {
+  FuncMap map = new_map(prog);
+
+  int n = 0;
+  for (Function *fn = prog; fn; fn = fn->next) {
+    CallCollector c = {ctx, &map, fn, 0};
+    fn->ncallees = 0;
+    walk_nodes(fn->node, collect_call, &c);
+    n++;
+  }
+
+  Function **funcs = calloc(n, sizeof(Function *));
+  n = 0;
+  for (Function *fn = prog; fn; fn = fn->next)
+    funcs[n++] = fn;
+  find_sccs(funcs, n);
+
+  free(funcs);
+  free(map.buckets);
+}
+
+// mainとrootsの関数から呼び出される関数だけを残したリストを返す。
+// 取り除いた関数はctx->removedにつなぐ。build_callgraphの後に呼び出すこと
+Function *remove_dead_functions(Ctx *ctx, Function *prog, char **roots, int nroots) {
+  FuncMap map = new_map(prog);
+
+  // 到達できる関数にbucketsの添字で印をつける。作業リストにはまだcalleesを調べていない関数を入れる
+  bool *live = calloc(map.cap, sizeof(bool));
+  Function **work = calloc(map.cap + nroots + 1, sizeof(Function *));
+  int nwork = 0;
+
+  Function *main_fn = find_func(&map, "main");
+  if (main_fn)
+    work[nwork++] = main_fn;
+  for (int i = 0; i < nroots; i++) {
+    Function *fn = find_func(&map, roots[i]);
+    if (!fn) {
+      free(live);
+      free(work);
+      free(map.buckets);
+      error_tok(ctx, NULL, "--export: no such function: %s", roots[i]);
+    }
+    work[nwork++] = fn;
+  }
+  if (nwork == 0) {
+    free(live);
+    free(work);
+    free(map.buckets);
+    error_tok(ctx, NULL, "--whole-program needs main or --export");
+  }
+
+  for (int i = 0; i < nwork; i++)
+    live[slot_of(&map, work[i])] = true;
+  while (nwork > 0) {
+    Function *fn = work[--nwork];
+    for (int i = 0; i < fn->ncallees; i++) {
+      int slot = slot_of(&map, fn->callees[i]);
+      if (!live[slot]) {
+        live[slot] = true;
+        work[nwork++] = fn->callees[i];
+      }
+    }
+  }
+
+  Function head = {0};
+  Function *cur = &head;
+  Function dead = {0};
+  Function *dead_cur = &dead;
+  for (Function *fn = prog; fn; fn = fn->next) {
+    if (live[slot_of(&map, fn)]) {
+      cur->next = fn;
+      cur = fn;
+    } else {
+      add_remark(ctx, fn, NULL, "dce", false, "removed %s: not called from main or --export", fn->name);
+      dead_cur->next = fn;
+      dead_cur = fn;
+    }
+  }
+  cur->next = NULL;
+  dead_cur->next = ctx->removed;
+  ctx->removed = dead.next;
+
+  free(live);
+  free(work);
+  free(map.buckets);
+  return head.next;
+}
+
+// --callgraph-reportで、build_callgraphの結果をfnの1行で出力する
+void print_callgraph(Ctx *ctx, Function *fn, FILE *out) {
+  flockfile(out);
+  if (ctx->filename)
+    fprintf(out, "%s: ", ctx->filename);
+  fprintf(out, "callgraph %s: scc %d", fn->name, fn->scc);
+  if (fn->recursive)
+    fprintf(out, ", recursive");
+  for (int i = 0; i < fn->ncallees; i++)
+    fprintf(out, "%s%s", i ? " " : ", calls ", fn->callees[i]->name);
+  fprintf(out, "\n");
+  funlockfile(out);
+}
@@ -1,244 +1,402 @@
 #include "9cc.h"
 
-int labelseq = 0;
-
-// 関数名
-char *funcname;
-
 // 関数呼び出し時の引数をセットしておくレジスタ。6つまで
-char *argreg[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+static char *argreg[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 
-// gen_addrで呼び出すために宣言
-static void gen(Node *node);
+// アセンブリを1行出力する
+// 字下げした行のうち"."で始まらないものを命令として、コード生成中の関数で数える
+static void emit(Ctx *ctx, char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(ctx->out, fmt, ap);
+  va_end(ap);
 
-// nodeの変数をアドレスに変換し、スタックへpush
-void gen_addr(Node *node) {
-  switch (node->kind) {
-  case ND_VAR:
-    printf("  lea rax, [rbp-%d]\n", node->var->offset);
-    printf("  push rax\n");
-    return;
-  case ND_DEREF:
-    gen(node->lhs);
-    return;
+  Function *fn = ctx->fn;
+  if (fn && fmt[0] == ' ' && fmt[1] == ' ' && fmt[2] != '.') {
+    fn->ninsns++;
+    if (!strncmp(fmt + 2, "push ", 5))
+      fn->npush++;
+    else if (!strncmp(fmt + 2, "pop ", 4))
+      fn->npop++;
   }
+}
 
-  error_tok(node->tok, "not an lvalue");
+// tokの行が前の.locと違えば、以降の命令の行番号として.locを出力する
+static void emit_loc(Ctx *ctx, Token *tok) {
+  if (!tok || tok->line_no == ctx->loc_line)
+    return;
+  ctx->loc_line = tok->line_no;
+  emit(ctx, "  .loc 1 %d\n", tok->line_no);
+}
+
+// gen()で子のノードのコード生成を待っているノード
+typedef struct {
+  Node *node;
+  bool addr;  // 値ではなくアドレスを生成する場合true
+  int state;  // コード生成がどこまで進んだか
+  int seq;    // ラベルの通し番号
+  Node *cur;  // ND_BLOCKとND_FUNCALLで次に生成する文や引数
+  int nargs;  // ND_FUNCALLの引数の個数
+} GenFrame;
+
+// 変数のアドレスをスタックへpush
+static void gen_var_addr(Ctx *ctx, Node *node) {
+  emit(ctx, "  lea rax, [rbp-%d]\n", node->var->offset);
+  emit(ctx, "  push rax\n");
 }
 
 // スタックからロード 
-void load() {
-  printf("  pop rax\n");
-  printf("  mov rax, [rax]\n");
-  printf("  push rax\n");
+static void load(Ctx *ctx) {
+  emit(ctx, "  pop rax\n");
+  emit(ctx, "  mov rax, [rax]\n");
+  emit(ctx, "  push rax\n");
 }
 
 // スタック(rsp)へストアする
-void store() {
-  printf("  pop rdi\n");
-  printf("  pop rax\n");
-  printf("  mov [rax], rdi\n");
-  printf("  push rdi\n");
+static void store(Ctx *ctx) {
+  emit(ctx, "  pop rdi\n");
+  emit(ctx, "  pop rax\n");
+  emit(ctx, "  mov [rax], rdi\n");
+  emit(ctx, "  push rdi\n");
 }
 
-static void gen(Node *node) {
-  // 文(Statement)
+// nodeの変数をアドレスに変換し、スタックへpush
+static Node *gen_addr_step(Ctx *ctx, GenFrame *f) {
+  Node *node = f->node;
   switch (node->kind) {
-  case ND_NUM:
-    printf("  push %d\n", node->val);
-    return;
-  case ND_EXPR_STMT:
-    gen(node->lhs);
-    printf("  add rsp, 8\n");
-    return;
   case ND_VAR:
-    gen_addr(node);
-    load();
-    return;
-  case ND_ASSIGN:
-    gen_addr(node->lhs);
-    gen(node->rhs);
-    store();
-    return;
-  case ND_ADDR:
-    gen_addr(node->lhs);
-    return;
+    gen_var_addr(ctx, node);
+    return NULL;
   case ND_DEREF:
-    gen(node->lhs);
-    load();
-    return;
-  case ND_IF: {
-    // アセンブリのジャンプ先を一意に決めるためのラベルに使用する
-    int seq = labelseq++;
-    // elseがあるなら
-    if (node->els) {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je  .Lelse%d\n", seq);
-      gen(node->then);
-      printf("  jmp .Lend%d\n", seq);
-      printf(".Lelse%d:\n", seq);
-      gen(node->els);
-      printf(".Lend%d:\n", seq);
-    } else {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je  .Lend%d\n", seq);
-      gen(node->then);
-      printf(".Lend%d:\n", seq);
-    }
-    return;
+    return f->state++ == 0 ? node->lhs : NULL;
   }
-  case ND_WHILE: {
-    int seq = labelseq++;
-    printf(".Lbegin%d:\n", seq);
-    gen(node->cond);
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je  .Lend%d\n", seq);
-    gen(node->then);
-    printf("  jmp .Lbegin%d\n", seq);
-    printf(".Lend%d:\n", seq);
-    return;
-  }
-  case ND_FOR: {
-    int seq = labelseq++;
-    if (node->init)
-      gen(node->init);
-    printf(".Lbegin%d:\n", seq);
-    if (node->cond) {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je  .Lend%d\n", seq);
+
+  error_tok(ctx, node->tok, "not an lvalue");
+  return NULL;
+}
+
+// f->nodeのコード生成を1段階進める。
+// 次にコードを生成する子のノードを返し、f->nodeのコード生成が終わったらNULLを返す。
+// 子のアドレスを生成する場合は*addrをtrueにする。
+static Node *gen_step(Ctx *ctx, GenFrame *f, bool *addr) {
+  Node *node = f->node;
+  if (f->addr)
+    return gen_addr_step(ctx, f);
+
+  // 文(Statement)
+  // 子を生成しない段階はcontinueで次の段階へ進む
+  for (;;) {
+    int state = f->state++;
+
+    switch (node->kind) {
+    case ND_NUM:
+      emit(ctx, "  push %d\n", node->val);
+      return NULL;
+    case ND_EXPR_STMT:
+      if (state == 0)
+        return node->lhs;
+      emit(ctx, "  add rsp, 8\n");
+      return NULL;
+    case ND_VAR:
+      gen_var_addr(ctx, node);
+      load(ctx);
+      return NULL;
+    case ND_ASSIGN:
+      if (state == 0) {
+        *addr = true;
+        return node->lhs;
+      }
+      if (state == 1)
+        return node->rhs;
+      store(ctx);
+      return NULL;
+    case ND_ADDR:
+      if (state == 0) {
+        *addr = true;
+        return node->lhs;
+      }
+      return NULL;
+    case ND_DEREF:
+      if (state == 0)
+        return node->lhs;
+      load(ctx);
+      return NULL;
+    case ND_IF:
+      switch (state) {
+      case 0:
+        // アセンブリのジャンプ先を一意に決めるためのラベルに使用する
+        f->seq = ctx->labelseq++;
+        return node->cond;
+      case 1:
+        emit(ctx, "  pop rax\n");
+        emit(ctx, "  cmp rax, 0\n");
+        // elseがあるなら
+        if (node->els)
+          emit(ctx, "  je  .Lelse.%s.%d\n", ctx->funcname, f->seq);
+        else
+          emit(ctx, "  je  .Lend.%s.%d\n", ctx->funcname, f->seq);
+        return node->then;
+      case 2:
+        if (node->els) {
+          emit(ctx, "  jmp .Lend.%s.%d\n", ctx->funcname, f->seq);
+          emit(ctx, ".Lelse.%s.%d:\n", ctx->funcname, f->seq);
+          return node->els;
+        }
+        continue;
+      default:
+        emit(ctx, ".Lend.%s.%d:\n", ctx->funcname, f->seq);
+        return NULL;
+      }
+    case ND_WHILE:
+      switch (state) {
+      case 0:
+        f->seq = ctx->labelseq++;
+        emit(ctx, ".Lbegin.%s.%d:\n", ctx->funcname, f->seq);
+        return node->cond;
+      case 1:
+        emit(ctx, "  pop rax\n");
+        emit(ctx, "  cmp rax, 0\n");
+        emit(ctx, "  je  .Lend.%s.%d\n", ctx->funcname, f->seq);
+        return node->then;
+      default:
+        emit(ctx, "  jmp .Lbegin.%s.%d\n", ctx->funcname, f->seq);
+        emit(ctx, ".Lend.%s.%d:\n", ctx->funcname, f->seq);
+        return NULL;
+      }
+    case ND_FOR:
+      switch (state) {
+      case 0:
+        f->seq = ctx->labelseq++;
+        if (node->init)
+          return node->init;
+        continue;
+      case 1:
+        emit(ctx, ".Lbegin.%s.%d:\n", ctx->funcname, f->seq);
+        if (node->cond)
+          return node->cond;
+        continue;
+      case 2:
+        if (node->cond) {
+          emit(ctx, "  pop rax\n");
+          emit(ctx, "  cmp rax, 0\n");
+          emit(ctx, "  je  .Lend.%s.%d\n", ctx->funcname, f->seq);
+        }
+        return node->then;
+      case 3:
+        if (node->inc)
+          return node->inc;
+        continue;
+      default:
+        emit(ctx, "  jmp .Lbegin.%s.%d\n", ctx->funcname, f->seq);
+        emit(ctx, ".Lend.%s.%d:\n", ctx->funcname, f->seq);
+        return NULL;
+      }
+    case ND_BLOCK:
+      if (state == 0)
+        f->cur = node->body;
+      if (f->cur) {
+        Node *n = f->cur;
+        f->cur = n->next;
+        return n;
+      }
+      return NULL;
+    case ND_FUNCALL: {
+      // 関数呼び出し時の引数の個数分、子として生成する
+      if (state == 0)
+        f->cur = node->args;
+      if (f->cur) {
+        Node *arg = f->cur;
+        f->cur = arg->next;
+        f->nargs++;
+        return arg;
+      }
+
+      // 引数の個数分、rspからレジスタへpopしてくる 
+      for (int i=f->nargs-1; i>=0; i--)
+        emit(ctx, "  pop %s\n", argreg[i]);
+
+      // ここ時点ではまだrspに呼び出される関数名は残っている。
+      // ※x86-64の関数呼び出しのABIの仕様で、関数呼び出し時にrspが16バイトの倍数になっていないと落ちる時があるのでrspを調整。
+      int seq = ctx->labelseq++;
+      ctx->fn->ncalls++;
+      ctx->fn->nalign_checks++;
+      emit(ctx, "  mov rax, rsp\n");
+      emit(ctx, "  and rax, 15\n");
+      emit(ctx, "  jnz .Lcall.%s.%d\n", ctx->funcname, seq);
+      emit(ctx, "  mov rax, 0\n");
+      emit(ctx, "  call %s\n", node->funcname);
+      emit(ctx, "  jmp .Lend.%s.%d\n", ctx->funcname, seq);
+      emit(ctx, ".Lcall.%s.%d:\n", ctx->funcname, seq);
+      emit(ctx, "  sub rsp, 8\n");
+      emit(ctx, "  mov rax, 0\n");
+      // ここで関数を呼び出す
+      emit(ctx, "  call %s\n", node->funcname);
+      emit(ctx, "  add rsp, 8\n");
+      emit(ctx, ".Lend.%s.%d:\n", ctx->funcname, seq);
+      emit(ctx, "  push rax\n");
+      return NULL;
     }
-    gen(node->then);
-    if (node->inc)
-      gen(node->inc);
-    printf("  jmp .Lbegin%d\n", seq);
-    printf(".Lend%d:\n", seq);
-    return;
-  }
-  case ND_BLOCK:
-    for (Node *n = node->body; n; n = n->next)
-      gen(n);
-    return;
-  case ND_FUNCALL: {
-    // 関数呼び出し時の引数の個数分、gen()を呼び出す
-    int nargs = 0;
-    for (Node *arg=node->args; arg; arg=arg->next) {
-      gen(arg);
-      nargs++;
+    case ND_RETURN:
+      if (state == 0)
+        return node->lhs;
+      emit(ctx, "  pop rax\n");
+      emit(ctx, "  jmp .Lreturn.%s\n", ctx->funcname);
+      return NULL;
     }
-    // 引数の個数分、rspからレジスタへpopしてくる 
-    for (int i=nargs-1; i>=0; i--)
-      printf("  pop %s\n", argreg[i]);
-    
-    // ここ時点ではまだrspに呼び出される関数名は残っている。
-    // ※x86-64の関数呼び出しのABIの仕様で、関数呼び出し時にrspが16バイトの倍数になっていないと落ちる時があるのでrspを調整。
-    int seq = labelseq++;
-    printf("  mov rax, rsp\n");
-    printf("  and rax, 15\n");
-    printf("  jnz .Lcall%d\n", seq);
-    printf("  mov rax, 0\n");
-    printf("  call %s\n", node->funcname);
-    printf("  jmp .Lend%d\n", seq);
-    printf(".Lcall%d:\n", seq);
-    printf("  sub rsp, 8\n");
-    printf("  mov rax, 0\n");
-    // ここで関数を呼び出す
-    printf("  call %s\n", node->funcname);
-    printf("  add rsp, 8\n");
-    printf(".Lend%d:\n", seq);
-    printf("  push rax\n");
-    return;
-  }
-  case ND_RETURN:
-    gen(node->lhs);
-    printf("  pop rax\n");
-    printf("  jmp .Lreturn.%s\n", funcname);
-    return;
+
+    if (state == 0)
+      return node->lhs; // 左辺を先に生成
+    if (state == 1)
+      return node->rhs; // 次に右辺を生成
+
+    emit(ctx, "  pop rdi\n"); // スタックの先頭をrdiへpop（内部ではその後rspが保持するアドレスを変更）
+    emit(ctx, "  pop rax\n"); // スタックの先頭をrazへpop
+
+    // 式(expression)
+    switch (node->kind) {
+    case ND_ADD:
+      emit(ctx, "  add rax, rdi\n");
+      break;
+    case ND_SUB:
+      emit(ctx, "  sub rax, rdi\n");
+      break;
+    case ND_MUL:
+      emit(ctx, "  imul rax, rdi\n");
+      break;
+    case ND_DIV:
+      emit(ctx, "  cqo\n");
+      emit(ctx, "  idiv rdi\n");
+      break;
+    case ND_EQ:
+      emit(ctx, "  cmp rax, rdi\n");
+      emit(ctx, "  sete al\n");
+      emit(ctx, "  movzb rax, al\n");
+      break;
+    case ND_NE:
+      emit(ctx, "  cmp rax, rdi\n");
+      emit(ctx, "  setne al\n");
+      emit(ctx, "  movzb rax, al\n");
+      break;
+    case ND_LT:
+      emit(ctx, "  cmp rax, rdi\n");
+      emit(ctx, "  setl al\n");
+      emit(ctx, "  movzb rax, al\n");
+      break;
+    case ND_LE:
+      emit(ctx, "  cmp rax, rdi\n");
+      emit(ctx, "  setle al\n");
+      emit(ctx, "  movzb rax, al\n");
+      break;
+    }
+
+    // スタックの最後に式全体の値が残っているので、それをRAXにロードして関数からの返却値とする
+    emit(ctx, "  push rax\n");
+    return NULL;
   }
+}
 
-  gen(node->lhs); // 左辺に対してgen()を再帰呼出
-  gen(node->rhs); // 右辺に対してgen()を再帰呼出
+// nodeのコードを生成する。
+// 深くネストした木でもCのスタックを使い切らないように、再帰せずに明示的なスタックを使う
+static void gen(Ctx *ctx, Node *node) {
+  GenFrame buf[64];
+  GenFrame *stack = buf;
+  int cap = sizeof(buf) / sizeof(*buf);
+  int n = 0;
 
-  printf("  pop rdi\n"); // スタックの先頭をrdiへpop（内部ではその後rspが保持するアドレスを変更）
-  printf("  pop rax\n"); // スタックの先頭をrazへpop
+  stack[n++] = (GenFrame){.node = node};
+  while (n > 0) {
+    bool addr = false;
+    emit_loc(ctx, stack[n - 1].node->tok);
+    Node *child = gen_step(ctx, &stack[n - 1], &addr);
+    if (!child) {
+      n--;
+      continue;
+    }
 
-  // 式(expression)
-  switch (node->kind) {
-  case ND_ADD:
-    printf("  add rax, rdi\n");
-    break;
-  case ND_SUB:
-    printf("  sub rax, rdi\n");
-    break;
-  case ND_MUL:
-    printf("  imul rax, rdi\n");
-    break;
-  case ND_DIV:
-    printf("  cqo\n");
-    printf("  idiv rdi\n");
-    break;
-  case ND_EQ:
-    printf("  cmp rax, rdi\n");
-    printf("  sete al\n");
-    printf("  movzb rax, al\n");
-    break;
-  case ND_NE:
-    printf("  cmp rax, rdi\n");
-    printf("  setne al\n");
-    printf("  movzb rax, al\n");
-    break;
-  case ND_LT:
-    printf("  cmp rax, rdi\n");
-    printf("  setl al\n");
-    printf("  movzb rax, al\n");
-    break;
-  case ND_LE:
-    printf("  cmp rax, rdi\n");
-    printf("  setle al\n");
-    printf("  movzb rax, al\n");
-    break;
+    if (n == cap) {
+      GenFrame *p = malloc(cap * 2 * sizeof(GenFrame));
+      memcpy(p, stack, cap * sizeof(GenFrame));
+      if (stack != buf)
+        free(stack);
+      stack = p;
+      cap *= 2;
+    }
+    stack[n++] = (GenFrame){.node = child, .addr = addr};
   }
 
-  // スタックの最後に式全体の値が残っているので、それをRAXにロードして関数からの返却値とする
-  printf("  push rax\n");
+  if (stack != buf)
+    free(stack);
 }
 
-void codegen(Function *prog) {
-  // アセンブリの前半部分を出力
-  printf(".intel_syntax noprefix\n");
+// 関数1つ分のアセンブリを生成する
+// ラベルの通し番号と.locの行番号は関数ごとに初めから振るので、関数単位で並列に生成しても出力は変わらない
+// .typeと.sizeでシンボルを関数にし、.cfi_*でスタックフレームを巻き戻せるようにする
+void codegen_function(Ctx *ctx, Function *fn) {
+  emit(ctx, ".global %s\n", fn->name);
+  emit(ctx, ".type %s, @function\n", fn->name);
+  emit(ctx, "%s:\n", fn->name);
+  emit(ctx, "  .cfi_startproc\n");
+  ctx->fn = fn;
+  fn->ninsns = fn->npush = fn->npop = fn->ncalls = fn->nalign_checks = 0;
+  ctx->funcname = fn->name;
+  ctx->labelseq = 0;
+  ctx->loc_line = 0;
+  emit_loc(ctx, fn->tok);
 
-  // 関数定義単位で実行する
-  for (Function *fn=prog; fn; fn=fn->next){
-    printf(".global %s\n", fn->name);
-    printf("%s:\n", fn->name);
-    funcname = fn->name;
-
-    // stack_sizeに格納されている分だけ、rspを拡張する
-    printf("  push rbp\n");
-    printf("  mov rbp, rsp\n");
-    printf("  sub rsp, %d\n", fn->stack_size);
-
-    // 引数をスタックへpushする
-    int i = 0;
-    for (VarList *vl = fn->params; vl; vl = vl->next) {
-      Var *var = vl->var;
-      printf("  mov [rbp-%d], %s\n", var->offset, argreg[i++]);
-    }
+  // stack_sizeに格納されている分だけ、rspを拡張する
+  emit(ctx, "  push rbp\n");
+  emit(ctx, "  .cfi_def_cfa_offset 16\n");
+  emit(ctx, "  .cfi_offset rbp, -16\n");
+  emit(ctx, "  mov rbp, rsp\n");
+  emit(ctx, "  .cfi_def_cfa_register rbp\n");
+  emit(ctx, "  sub rsp, %d\n", fn->stack_size);
 
-    // 抽象構文木を下りながらコード生成
-    for (Node *n=fn->node; n; n=n->next)
-      gen(n);
-    
-    // エピローグ
-    printf(".Lreturn.%s:\n", funcname);
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");
-    printf("  ret\n");
+  // 引数をスタックへpushする
+  int i = 0;
+  for (VarList *vl = fn->params; vl; vl = vl->next) {
+    Var *var = vl->var;
+    emit(ctx, "  mov [rbp-%d], %s\n", var->offset, argreg[i++]);
   }
+
+  // 抽象構文木を下りながらコード生成
+  for (Node *n=fn->node; n; n=n->next)
+    gen(ctx, n);
+
+  // エピローグ
+  emit(ctx, ".Lreturn.%s:\n", ctx->funcname);
+  emit(ctx, "  mov rsp, rbp\n");
+  emit(ctx, "  pop rbp\n");
+  emit(ctx, "  .cfi_def_cfa rsp, 8\n");
+  emit(ctx, "  ret\n");
+  ctx->fn = NULL;
+  emit(ctx, "  .cfi_endproc\n");
+  emit(ctx, ".size %s, .-%s\n", fn->name, fn->name);
+}
+
+// sを"と\\をエスケープした文字列リテラルとして出力する
+static void emit_string(Ctx *ctx, char *s) {
+  emit(ctx, "\"");
+  for (char *p = s; *p; p++)
+    emit(ctx, *p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+  emit(ctx, "\"");
+}
+
+// アセンブリの前半部分を出力
+// .locの行番号は.fileの1番のファイルを指す。コマンドライン引数のプログラムは"-"とする
+void codegen_header(Ctx *ctx) {
+  char *name = ctx->filename ? ctx->filename : "-";
+  emit(ctx, ".intel_syntax noprefix\n");
+  emit(ctx, ".file ");
+  emit_string(ctx, name);
+  emit(ctx, "\n.file 1 ");
+  emit_string(ctx, name);
+  emit(ctx, "\n");
+}
+
+void codegen(Ctx *ctx, Function *prog) {
+  codegen_header(ctx);
+
+  // 関数定義単位で実行する
+  for (Function *fn=prog; fn; fn=fn->next)
+    codegen_function(ctx, fn);
 }
\ No newline at end of file
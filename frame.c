@@ -0,0 +1,391 @@
+#include "9cc.h"
+
+/**
+ * スタックフレームの割り当て
+ *
+ * 関数の本体を基本ブロックの制御フローグラフに直し、変数の生存区間を求める。
+ * 同時に生きている変数どうしを干渉グラフの辺で結び、辺で結ばれていない変数には
+ * 同じ8バイトのスロットを割り当ててフレームを小さくする（グラフ彩色）。
+ *
+ * "&"で変数のアドレスを取る関数は、ポインタ演算で隣の変数にも届くので、
+ * 全ての変数にそれぞれのスロットを割り当てる。
+ */
+
+// 制御フローグラフを作る再帰の深さの上限。超えた関数ではスロットを共有しない
+#define MAX_NEST 1000
+
+// 変数の数の上限。干渉グラフは変数の数の2乗のビットを使うので、超えた関数ではスロットを共有しない
+#define MAX_LOCALS 2048
+
+// 基本ブロック。events[start..end)の順に変数を使ったり代入したりする
+typedef struct {
+  int start, end;
+  int succ[2]; // 後続のブロックの番号。なければ-1
+} Block;
+
+// 変数の集合。変数の番号のビットを立てる
+typedef unsigned long *Set;
+
+// 解析中の関数の状態
+typedef struct {
+  Function *fn;
+  int nvars;
+  int nwords; // Setの要素数
+
+  // eventsの要素は、変数の番号をiとして、使う場合はi*2、代入する場合はi*2+1
+  int *events;
+  int nevents, events_cap;
+
+  Block *blocks;
+  int nblocks, blocks_cap;
+  int cur;     // イベントを追加しているブロック
+
+  int depth;
+  bool too_deep;
+} Liveness;
+
+static void set_add(Set s, int i) {
+  s[i / 64] |= 1UL << (i % 64);
+}
+
+static void set_del(Set s, int i) {
+  s[i / 64] &= ~(1UL << (i % 64));
+}
+
+static void add_event(Liveness *lv, int ev) {
+  if (lv->nevents == lv->events_cap) {
+    lv->events_cap = lv->events_cap ? lv->events_cap * 2 : 64;
+    lv->events = realloc(lv->events, lv->events_cap * sizeof(int));
+  }
+  lv->events[lv->nevents++] = ev;
+}
+
+// 空の基本ブロックを作ってその番号を返す
+static int new_block(Liveness *lv) {
+  if (lv->nblocks == lv->blocks_cap) {
+    lv->blocks_cap = lv->blocks_cap ? lv->blocks_cap * 2 : 16;
+    lv->blocks = realloc(lv->blocks, lv->blocks_cap * sizeof(Block));
+  }
+  lv->blocks[lv->nblocks] = (Block){lv->nevents, lv->nevents, {-1, -1}};
+  return lv->nblocks++;
+}
+
+// 今のブロックを閉じて、succへ分岐させる
+static void end_block(Liveness *lv, int succ0, int succ1) {
+  Block *b = &lv->blocks[lv->cur];
+  b->end = lv->nevents;
+  b->succ[0] = succ0;
+  b->succ[1] = succ1;
+}
+
+// 今のブロックを閉じてnextへ続け、nextにイベントを追加していく
+static void start_block(Liveness *lv, int next) {
+  end_block(lv, next, -1);
+  lv->blocks[next].start = lv->nevents;
+  lv->cur = next;
+}
+
+static void visit(Liveness *lv, Node *node);
+
+// ノードのリストをそれぞれ順に訪れる
+static void visit_list(Liveness *lv, Node *node) {
+  for (; node; node = node->next)
+    visit(lv, node);
+}
+
+// nodeの変数の使用と代入を、codegen.cでコードを生成する順にeventsへ追加する
+static void visit(Liveness *lv, Node *node) {
+  if (!node || lv->too_deep)
+    return;
+  if (++lv->depth > MAX_NEST) {
+    lv->too_deep = true;
+    return;
+  }
+
+  switch (node->kind) {
+  case ND_NUM:
+    break;
+  case ND_VAR:
+    add_event(lv, node->var->offset * 2);
+    break;
+  case ND_ASSIGN:
+    if (node->lhs->kind == ND_VAR) {
+      visit(lv, node->rhs);
+      add_event(lv, node->lhs->var->offset * 2 + 1);
+    } else {
+      visit(lv, node->lhs->lhs); // *p = ... の p
+      visit(lv, node->rhs);
+    }
+    break;
+  case ND_FUNCALL:
+    visit_list(lv, node->args);
+    break;
+  case ND_BLOCK:
+    visit_list(lv, node->body);
+    break;
+  case ND_RETURN:
+    visit(lv, node->lhs);
+    // returnの後は到達しないブロックにする
+    end_block(lv, -1, -1);
+    lv->cur = new_block(lv);
+    break;
+  case ND_IF: {
+    visit(lv, node->cond);
+    int then = new_block(lv);
+    int els = node->els ? new_block(lv) : -1;
+    int join = new_block(lv);
+    end_block(lv, then, els >= 0 ? els : join);
+
+    lv->blocks[then].start = lv->nevents;
+    lv->cur = then;
+    visit(lv, node->then);
+    if (els >= 0) {
+      end_block(lv, join, -1);
+      lv->blocks[els].start = lv->nevents;
+      lv->cur = els;
+      visit(lv, node->els);
+    }
+    start_block(lv, join);
+    break;
+  }
+  case ND_WHILE:
+  case ND_FOR: {
+    if (node->kind == ND_FOR)
+      visit(lv, node->init);
+    int head = new_block(lv);
+    int body = new_block(lv);
+    int done = new_block(lv);
+
+    start_block(lv, head);
+    visit(lv, node->cond);
+    // forで条件を省略した場合はreturnでしか抜けない
+    end_block(lv, body, node->cond ? done : -1);
+
+    lv->blocks[body].start = lv->nevents;
+    lv->cur = body;
+    visit(lv, node->then);
+    if (node->kind == ND_FOR)
+      visit(lv, node->inc);
+    end_block(lv, head, -1);
+
+    lv->blocks[done].start = lv->nevents;
+    lv->cur = done;
+    break;
+  }
+  default:
+    // 単項演算子と2項演算子。ND_ADDRの関数は解析しない
+    visit(lv, node->lhs);
+    visit(lv, node->rhs);
+    break;
+  }
+  lv->depth--;
+}
+
+// eventsを後ろからたどって、ブロックbの出口で生きている変数liveを入口で生きている変数に変える
+// interferenceがあれば、代入した変数とその時点で生きている変数を干渉グラフの辺で結ぶ
+static void transfer(Liveness *lv, Block *b, Set live, Set *interference) {
+  for (int i = b->end - 1; i >= b->start; i--) {
+    int ev = lv->events[i];
+    int var = ev / 2;
+    if (ev % 2 == 0) {
+      set_add(live, var);
+      continue;
+    }
+    if (interference)
+      for (int w = 0; w < lv->nwords; w++)
+        interference[var][w] |= live[w];
+    set_del(live, var);
+  }
+}
+
+// 変数の干渉グラフを作る。interference[i]は変数iを代入した時点で生きている変数の集合
+// 変数iとjの辺は、interference[i]とinterference[j]のどちらか一方にだけある場合もある
+static Set *build_interference(Liveness *lv) {
+  int n = lv->nblocks;
+  int nw = lv->nwords;
+  Set mem = calloc((size_t)(2 * n + 1) * nw, sizeof(unsigned long));
+  Set *live_in = calloc(n, sizeof(Set));
+  Set *live_out = calloc(n, sizeof(Set));
+  for (int i = 0; i < n; i++) {
+    live_in[i] = mem + (size_t)i * nw;
+    live_out[i] = mem + (size_t)(n + i) * nw;
+  }
+  Set tmp = mem + (size_t)2 * n * nw;
+
+  Set graph = calloc((size_t)lv->nvars * nw, sizeof(unsigned long));
+  Set *interference = calloc(lv->nvars, sizeof(Set));
+  for (int i = 0; i < lv->nvars; i++)
+    interference[i] = graph + (size_t)i * nw;
+
+  // 生存区間が変わらなくなるまで、ブロックを後ろから繰り返したどる
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int i = n - 1; i >= 0; i--) {
+      Block *b = &lv->blocks[i];
+      for (int j = 0; j < 2; j++)
+        if (b->succ[j] >= 0)
+          for (int w = 0; w < nw; w++)
+            live_out[i][w] |= live_in[b->succ[j]][w];
+
+      memcpy(tmp, live_out[i], nw * sizeof(unsigned long));
+      transfer(lv, b, tmp, NULL);
+      if (memcmp(tmp, live_in[i], nw * sizeof(unsigned long))) {
+        memcpy(live_in[i], tmp, nw * sizeof(unsigned long));
+        changed = true;
+      }
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    memcpy(tmp, live_out[i], nw * sizeof(unsigned long));
+    transfer(lv, &lv->blocks[i], tmp, interference);
+  }
+
+  // 引数は関数の入口で同時に代入される
+  memcpy(tmp, live_in[0], nw * sizeof(unsigned long));
+  for (VarList *vl = lv->fn->params; vl; vl = vl->next)
+    set_add(tmp, vl->var->offset);
+  for (VarList *vl = lv->fn->params; vl; vl = vl->next)
+    for (int w = 0; w < nw; w++)
+      interference[vl->var->offset][w] |= tmp[w];
+
+  free(mem);
+  free(live_in);
+  free(live_out);
+  return interference;
+}
+
+// 宣言の逆順に、干渉する変数が使っていない一番小さいスロットを選んでslot[i]に入れる
+// 使ったスロットの数を返す
+static int color(Liveness *lv, Set *interference, int *slot) {
+  int nw = lv->nwords;
+  Set members = calloc((size_t)lv->nvars * nw, sizeof(unsigned long)); // スロットsの変数の集合
+  Set conflicts = calloc((size_t)lv->nvars * nw, sizeof(unsigned long)); // スロットsの変数と干渉する変数の集合
+  int nslots = 0;
+
+  for (int i = 0; i < lv->nvars; i++) {
+    int s = 0;
+    for (; s < nslots; s++) {
+      Set m = members + (size_t)s * nw;
+      if (conflicts[(size_t)s * nw + i / 64] >> (i % 64) & 1)
+        continue;
+      int w = 0;
+      while (w < nw && !(m[w] & interference[i][w]))
+        w++;
+      if (w == nw)
+        break;
+    }
+    if (s == nslots)
+      nslots++;
+
+    slot[i] = s;
+    set_add(members + (size_t)s * nw, i);
+    for (int w = 0; w < nw; w++)
+      conflicts[(size_t)s * nw + w] |= interference[i][w];
+  }
+
+  free(members);
+  free(conflicts);
+  return nslots;
+}
+
+static void find_addr(Node *node, void *arg) {
+  Node **addr = arg;
+  if (node->kind == ND_ADDR && !*addr)
+    *addr = node;
+}
+
+// 変数ごとに8バイトのスロットを、宣言の逆順に割り当てる
+static void assign_unshared(Function *fn) {
+  int offset = 0;
+  for (VarList *vl=fn->locals; vl; vl=vl->next) {
+    offset += 8;
+    vl->var->offset = offset;
+  }
+  fn->stack_size = offset;
+  fn->nslots = fn->nlocals;
+}
+
+// 生存区間が重ならない変数に同じスロットを割り当てる
+// 割り当てられなかった場合はfalseを返し、fn->noshareに理由を入れる
+static bool assign_shared(Ctx *ctx, Function *fn) {
+  if (fn->nlocals > MAX_LOCALS) {
+    fn->noshare = "too many locals";
+    add_remark(ctx, fn, NULL, "slots", true, "locals not shared: %d locals (limit %d)", fn->nlocals, MAX_LOCALS);
+    return false;
+  }
+
+  Node *addr = NULL;
+  walk_nodes(fn->node, find_addr, &addr);
+  if (addr) {
+    fn->noshare = "address taken";
+    add_remark(ctx, fn, addr->tok, "slots", true, "locals not shared: address taken");
+    return false;
+  }
+
+  // 解析の間は変数の番号をoffsetに入れておく
+  Var **vars = calloc(fn->nlocals, sizeof(Var *));
+  int i = 0;
+  for (VarList *vl = fn->locals; vl; vl = vl->next) {
+    vars[i] = vl->var;
+    vl->var->offset = i++;
+  }
+
+  Liveness lv = {.fn = fn, .nvars = fn->nlocals, .nwords = (fn->nlocals + 63) / 64};
+  lv.cur = new_block(&lv);
+  visit_list(&lv, fn->node);
+  end_block(&lv, -1, -1);
+
+  bool ok = !lv.too_deep;
+  if (!ok) {
+    fn->noshare = "nested too deep";
+    add_remark(ctx, fn, NULL, "slots", true, "locals not shared: nested more than %d deep", MAX_NEST);
+  } else {
+    Set *interference = build_interference(&lv);
+
+    int *slot = calloc(lv.nvars, sizeof(int));
+    int nslots = color(&lv, interference, slot);
+    for (int i = 0; i < lv.nvars; i++)
+      vars[i]->offset = (slot[i] + 1) * 8;
+    fn->nslots = nslots;
+    fn->stack_size = nslots * 8;
+
+    free(interference[0]);
+    free(interference);
+    free(slot);
+  }
+
+  free(vars);
+  free(lv.events);
+  free(lv.blocks);
+  return ok;
+}
+
+// fnの変数にRBPからのoffsetを割り当て、stack_sizeを設定する
+void assign_offsets(Ctx *ctx, Function *fn) {
+  fn->nlocals = 0;
+  for (VarList *vl = fn->locals; vl; vl = vl->next)
+    fn->nlocals++;
+  fn->noshare = NULL;
+
+  if (fn->nlocals < 2 || !assign_shared(ctx, fn))
+    assign_unshared(fn);
+  else if (fn->nslots < fn->nlocals)
+    add_remark(ctx, fn, NULL, "slots", false, "%d locals share %d slots, saving %d bytes",
+               fn->nlocals, fn->nslots, (fn->nlocals - fn->nslots) * 8);
+  else
+    add_remark(ctx, fn, NULL, "slots", true, "locals not shared: live ranges of all %d locals overlap", fn->nlocals);
+}
+
+// fnのフレームの大きさをoutへ1行で出力する
+void print_frame(Ctx *ctx, Function *fn, FILE *out) {
+  flockfile(out);
+  if (ctx->filename)
+    fprintf(out, "%s: ", ctx->filename);
+  fprintf(out, "frame %s: %d bytes, %d locals in %d slots", fn->name, fn->stack_size, fn->nlocals, fn->nslots);
+  if (fn->noshare)
+    fprintf(out, " (not shared: %s)\n", fn->noshare);
+  else
+    fprintf(out, " (%d bytes without sharing)\n", fn->nlocals * 8);
+  funlockfile(out);
+}
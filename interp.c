@@ -0,0 +1,553 @@
+#include "9cc.h"
+
+/**
+ * 抽象構文木のインタプリタ
+ *
+ * codegen.cが生成するコードと同じ意味で関数を実行する。値は64ビットの整数で、
+ * ローカル変数はcodegen.cと同じoffsetでメモリ上のスタックフレームに置くので、
+ * "&"で取ったアドレスのポインタ演算も同じように振る舞う。
+ *
+ * 実行できるノードの数(fuel)と関数呼び出しとノードのネストの深さに上限があり、
+ * 超えた場合や0除算、初期化していない変数の読み出しなどは評価の失敗になる。
+ *
+ * fold_callsは純粋な関数を定数の引数で呼び出している箇所をコンパイル時に評価し、
+ * ND_NUMに置き換える。run_mainは--interpでmain()を実行する。
+ */
+
+// ポインタの値の下限。小さい整数がアドレスとして通らないように、メモリの先頭をずらしておく
+#define MEM_BASE 0x10000000L
+
+// fold_callsで呼び出し1つの評価に使う上限
+#define FOLD_FUEL 1000000
+#define FOLD_DEPTH 1000
+#define FOLD_STACK (1 << 20)
+
+// run_mainの上限。燃料は呼び出し元が決める
+#define RUN_DEPTH 20000
+#define RUN_STACK (8 << 20)
+
+typedef struct {
+  long fuel;       // 残りの実行できるノードの数
+  int max_depth;   // 評価を待っているノードの数の上限
+
+  // 実行中のスタック。アドレスが小さい方へ伸びる
+  unsigned char *mem;
+  unsigned char *defined; // 値を書き込んだバイトなら1
+  long size;
+  long sp;         // mem[sp]がスタックの先頭
+  long rbp;        // 実行中の関数のフレームの基準
+
+  bool returning;  // returnで関数を抜けている途中
+  long retval;
+
+  // 評価に失敗した場合の理由
+  bool failed;
+  char *msg;
+  Node *where;
+} Interp;
+
+static long fail(Interp *ip, Node *node, char *msg) {
+  if (!ip->failed) {
+    ip->failed = true;
+    ip->msg = msg;
+    ip->where = node;
+  }
+  return 0;
+}
+
+// addrから8バイトがスタックの中にあればmemでの位置を、なければ-1を返す
+static long mem_index(Interp *ip, long addr) {
+  if (addr < MEM_BASE || addr - MEM_BASE > ip->size - 8)
+    return -1;
+  return addr - MEM_BASE;
+}
+
+static long load(Interp *ip, Node *node, long addr) {
+  long i = mem_index(ip, addr);
+  if (i < 0)
+    return fail(ip, node, "invalid memory access");
+  for (int j = 0; j < 8; j++)
+    if (!ip->defined[i + j])
+      return fail(ip, node, "read of uninitialized memory");
+  long val;
+  memcpy(&val, ip->mem + i, 8);
+  return val;
+}
+
+static void store(Interp *ip, Node *node, long addr, long val) {
+  long i = mem_index(ip, addr);
+  if (i < 0) {
+    fail(ip, node, "invalid memory access");
+    return;
+  }
+  memcpy(ip->mem + i, &val, 8);
+  memset(ip->defined + i, 1, 8);
+}
+
+// 2項演算子の値を返す。codegen.cと同じく64ビットで計算する
+static long binary(Interp *ip, Node *node, long lhs, long rhs) {
+  switch (node->kind) {
+  case ND_ADD:
+    return (long)((unsigned long)lhs + (unsigned long)rhs);
+  case ND_SUB:
+    return (long)((unsigned long)lhs - (unsigned long)rhs);
+  case ND_MUL:
+    return (long)((unsigned long)lhs * (unsigned long)rhs);
+  case ND_DIV:
+    // idivはどちらの場合も例外になる
+    if (rhs == 0 || (lhs == -0x7fffffffffffffffL - 1 && rhs == -1))
+      return fail(ip, node, "division error");
+    return lhs / rhs;
+  case ND_EQ:
+    return lhs == rhs;
+  case ND_NE:
+    return lhs != rhs;
+  case ND_LT:
+    return lhs < rhs;
+  case ND_LE:
+    return lhs <= rhs;
+  default:
+    return fail(ip, node, "unknown node");
+  }
+}
+
+// eval_stepで子の評価を待っているノード。関数呼び出しは引数を評価した後、同じフレームで本体を実行する
+typedef struct {
+  Node *node;
+  int state;       // 評価がどこまで進んだか
+  Node *cur;       // ND_BLOCK, ND_FUNCALLの引数, 関数本体で次に評価するノード
+  long lhs;        // 先に評価した左辺の値か、代入先のアドレス
+  long args[6];
+  int nargs;
+
+  // 関数本体を実行している場合に使う
+  Function *fn;
+  long old_rbp;
+  long old_sp;
+} EvalFrame;
+
+// f->nodeからfnをargsで呼び出すフレームを作り、f->fnを設定する。失敗したらfalseを返す
+static bool enter(Interp *ip, EvalFrame *f, Function *fn, long *args, int nargs) {
+  int nparams = 0;
+  for (VarList *vl = fn->params; vl; vl = vl->next)
+    nparams++;
+  if (nargs != nparams) {
+    fail(ip, f->node, "wrong number of arguments");
+    return false;
+  }
+
+  // codegen.cのプロローグと同じく、戻りアドレスとrbpを積んでからフレームを確保する
+  f->old_rbp = ip->rbp;
+  f->old_sp = ip->sp;
+  ip->sp -= 16;
+  ip->rbp = ip->sp;
+  ip->sp -= fn->stack_size;
+  if (ip->sp < 0) {
+    ip->sp = f->old_sp;
+    ip->rbp = f->old_rbp;
+    fail(ip, f->node, "stack overflow");
+    return false;
+  }
+  memset(ip->defined + ip->sp, 0, fn->stack_size);
+
+  int i = 0;
+  for (VarList *vl = fn->params; vl; vl = vl->next)
+    store(ip, f->node, MEM_BASE + ip->rbp - vl->var->offset, args[i++]);
+
+  f->fn = fn;
+  f->cur = fn->node;
+  return true;
+}
+
+// 関数本体の次の文を返す。returnしたか最後の文まで実行したら、フレームを戻して*resultに戻り値を入れる
+static Node *body_step(Interp *ip, EvalFrame *f, long *result) {
+  if (!ip->returning && f->cur) {
+    Node *n = f->cur;
+    f->cur = n->next;
+    return n;
+  }
+
+  if (ip->returning)
+    *result = ip->retval;
+  else
+    fail(ip, f->node, "reached the end of a function without return");
+  ip->returning = false;
+  ip->rbp = f->old_rbp;
+  ip->sp = f->old_sp;
+  return NULL;
+}
+
+// 代入先や"&"の対象lvalueのアドレスを求める。
+// 変数なら*addrに入れてNULLを返し、ND_DEREFならアドレスとして評価する子を返す
+static Node *addr_step(Interp *ip, Node *lvalue, long *addr) {
+  if (lvalue->kind == ND_VAR) {
+    *addr = MEM_BASE + ip->rbp - lvalue->var->offset;
+    return NULL;
+  }
+  if (lvalue->kind == ND_DEREF)
+    return lvalue->lhs;
+  fail(ip, lvalue, "not an lvalue");
+  return NULL;
+}
+
+// f->nodeの評価を1段階進める。valは直前に評価し終わった子の値。
+// 次に評価する子のノードを返し、f->nodeの評価が終わったら*resultに値を入れてNULLを返す。
+// 文の場合の値は使わない
+static Node *eval_step(Interp *ip, EvalFrame *f, long val, long *result) {
+  Node *node = f->node;
+  if (f->fn)
+    return body_step(ip, f, result);
+
+  // 子を評価しない段階はcontinueで次の段階へ進む
+  for (;;) {
+    int state = f->state++;
+
+    switch (node->kind) {
+    case ND_NUM:
+      *result = node->val;
+      return NULL;
+    case ND_VAR:
+      *result = load(ip, node, MEM_BASE + ip->rbp - node->var->offset);
+      return NULL;
+    case ND_ADDR:
+      if (state == 0) {
+        Node *child = addr_step(ip, node->lhs, result);
+        return child;
+      }
+      *result = val;
+      return NULL;
+    case ND_DEREF:
+      if (state == 0)
+        return node->lhs;
+      *result = load(ip, node, val);
+      return NULL;
+    case ND_ASSIGN:
+      if (state == 0) {
+        Node *child = addr_step(ip, node->lhs, &f->lhs);
+        if (child || ip->failed)
+          return child;
+        f->state = 2;
+        return node->rhs;
+      }
+      if (state == 1) {
+        f->lhs = val;
+        return node->rhs;
+      }
+      store(ip, node, f->lhs, val);
+      *result = val;
+      return NULL;
+    case ND_FUNCALL:
+      if (state == 0)
+        f->cur = node->args;
+      else
+        f->args[f->nargs++] = val;
+      if (f->cur) {
+        if (f->nargs == 6) {
+          fail(ip, node, "too many arguments");
+          return NULL;
+        }
+        Node *arg = f->cur;
+        f->cur = arg->next;
+        return arg;
+      }
+      if (!node->func) {
+        fail(ip, node, "call to undefined function");
+        return NULL;
+      }
+      if (!enter(ip, f, node->func, f->args, f->nargs))
+        return NULL;
+      return body_step(ip, f, result);
+    case ND_EXPR_STMT:
+      if (state == 0)
+        return node->lhs;
+      return NULL;
+    case ND_RETURN:
+      if (state == 0)
+        return node->lhs;
+      ip->retval = val;
+      ip->returning = true;
+      return NULL;
+    case ND_IF:
+      if (state == 0)
+        return node->cond;
+      if (state == 1) {
+        if (val)
+          return node->then;
+        if (node->els)
+          return node->els;
+      }
+      return NULL;
+    case ND_WHILE:
+    case ND_FOR:
+      // 0: 初期化, 1: 条件, 2: 条件の値を調べる, 3: 本体の後, 4: 増分の後
+      if (state == 0) {
+        if (node->init)
+          return node->init;
+        continue;
+      }
+      if (state == 1) {
+        if (node->cond)
+          return node->cond;
+        val = 1;
+        continue;
+      }
+      if (state == 2) {
+        if (!val)
+          return NULL;
+        return node->then;
+      }
+      if (state == 3) {
+        if (node->inc)
+          return node->inc;
+        continue;
+      }
+      // ループ1周ごとにも燃料を使い、空のループでも止まるようにする
+      if (--ip->fuel < 0) {
+        fail(ip, node, "out of fuel");
+        return NULL;
+      }
+      f->state = 1;
+      continue;
+    case ND_BLOCK:
+      if (state == 0)
+        f->cur = node->body;
+      if (f->cur) {
+        Node *n = f->cur;
+        f->cur = n->next;
+        return n;
+      }
+      return NULL;
+    default:
+      if (state == 0)
+        return node->lhs;
+      if (state == 1) {
+        f->lhs = val;
+        return node->rhs;
+      }
+      *result = binary(ip, node, f->lhs, val);
+      return NULL;
+    }
+  }
+}
+
+// fnをargsで呼び出して戻り値を返す。nodeは呼び出し元のノードで、なければNULL
+// 深くネストした木や深い再帰でもCのスタックを使い切らないように、再帰せずに明示的なスタックを使う。
+// スタックの深さがmax_depthを超えたら"nested too deep"で失敗する
+static long call(Interp *ip, Node *node, Function *fn, long *args, int nargs) {
+  long old_rbp = ip->rbp;
+  long old_sp = ip->sp;
+
+  EvalFrame buf[64];
+  EvalFrame *stack = buf;
+  int cap = sizeof(buf) / sizeof(*buf);
+  int n = 0;
+  long val = 0;
+
+  stack[0] = (EvalFrame){.node = node};
+  if (enter(ip, &stack[0], fn, args, nargs))
+    n = 1;
+
+  while (n > 0 && !ip->failed) {
+    EvalFrame *f = &stack[n - 1];
+
+    // returnしたら関数本体のフレームまで戻る
+    if (ip->returning && !f->fn) {
+      n--;
+      continue;
+    }
+
+    long result = 0;
+    Node *child = eval_step(ip, f, val, &result);
+    if (!child) {
+      val = result;
+      n--;
+      continue;
+    }
+
+    if (--ip->fuel < 0) {
+      fail(ip, child, "out of fuel");
+      break;
+    }
+    if (n > ip->max_depth) {
+      fail(ip, child, "nested too deep");
+      break;
+    }
+    if (n == cap) {
+      EvalFrame *p = malloc(cap * 2 * sizeof(EvalFrame));
+      memcpy(p, stack, cap * sizeof(EvalFrame));
+      if (stack != buf)
+        free(stack);
+      stack = p;
+      cap *= 2;
+    }
+    stack[n++] = (EvalFrame){.node = child};
+  }
+
+  if (stack != buf)
+    free(stack);
+
+  // 失敗した場合は途中のフレームを戻していないので、ここでまとめて戻す
+  ip->returning = false;
+  ip->rbp = old_rbp;
+  ip->sp = old_sp;
+  return ip->failed ? 0 : val;
+}
+
+static void init_interp(Interp *ip, long fuel, int max_depth, long size) {
+  *ip = (Interp){0};
+  ip->fuel = fuel;
+  ip->max_depth = max_depth;
+  ip->size = size;
+  ip->mem = malloc(size);
+  ip->defined = calloc(size, 1);
+  ip->sp = ip->rbp = size;
+}
+
+static void free_interp(Interp *ip) {
+  free(ip->mem);
+  free(ip->defined);
+}
+
+// ポインタを使ったり、定義のない関数を呼び出したりするノードがあれば、最初のものをimpureに入れる
+static void find_impure(Node *node, void *arg) {
+  Node **impure = arg;
+  if (!*impure && (node->kind == ND_ADDR || node->kind == ND_DEREF ||
+                   (node->kind == ND_FUNCALL && !node->func)))
+    *impure = node;
+}
+
+// 純粋な関数にpureを設定する。呼び出す関数も全て純粋でなければならない
+// 相互再帰する関数は純粋だと仮定して始め、純粋でない関数を呼び出すものを除いていく
+static void find_pure(Function *prog) {
+  for (Function *fn = prog; fn; fn = fn->next) {
+    Node *impure = NULL;
+    walk_nodes(fn->node, find_impure, &impure);
+    fn->pure = !impure;
+  }
+
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (Function *fn = prog; fn; fn = fn->next) {
+      if (!fn->pure)
+        continue;
+      for (int i = 0; i < fn->ncallees; i++) {
+        if (!fn->callees[i]->pure) {
+          fn->pure = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// fnが純粋でない理由を返す。Remarkにだけ使う
+static char *impure_reason(Ctx *ctx, Function *fn) {
+  Node *impure = NULL;
+  walk_nodes(fn->node, find_impure, &impure);
+  char *buf = new_obj(ctx, AL_STRING, 256);
+  if (impure && impure->kind == ND_FUNCALL)
+    snprintf(buf, 256, "%s calls %s, which has no definition", fn->name, impure->funcname);
+  else if (impure)
+    snprintf(buf, 256, "%s uses a pointer", fn->name);
+  else
+    for (int i = 0; i < fn->ncallees; i++)
+      if (!fn->callees[i]->pure)
+        snprintf(buf, 256, "%s calls %s, which is not pure", fn->name, fn->callees[i]->name);
+  return buf;
+}
+
+// 関数本体の呼び出しをソースの順に集めるときの状態
+typedef struct {
+  Node **calls;
+  int ncalls;
+  int cap;
+} CallList;
+
+static void collect_call(Node *node, void *arg) {
+  CallList *l = arg;
+  if (node->kind != ND_FUNCALL || !node->func)
+    return;
+  if (l->ncalls == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 16;
+    l->calls = realloc(l->calls, l->cap * sizeof(Node *));
+  }
+  l->calls[l->ncalls++] = node;
+}
+
+// fnの中で、純粋な関数を定数の引数で呼び出していれば、評価した値のND_NUMに置き換える
+static void fold_call(Ctx *ctx, Interp *ip, Function *fn, Node *node) {
+  long args[6];
+  int nargs = 0;
+  for (Node *a = node->args; a; a = a->next) {
+    if (a->kind != ND_NUM || nargs == 6)
+      return;
+    args[nargs++] = a->val;
+  }
+
+  Function *callee = node->func;
+  if (!callee->pure) {
+    if (ctx->opt.remarks)
+      add_remark(ctx, fn, node->tok, "fold", true, "call to %s not folded: %s", callee->name, impure_reason(ctx, callee));
+    return;
+  }
+
+  ip->fuel = FOLD_FUEL;
+  ip->failed = false;
+  long val = call(ip, node, callee, args, nargs);
+
+  // ND_NUMはint。push命令の即値も32ビットなので、収まらない値は置き換えない
+  if (ip->failed) {
+    add_remark(ctx, fn, node->tok, "fold", true, "call to %s not folded: %s", callee->name, ip->msg);
+    return;
+  }
+  if (val != (int)val) {
+    add_remark(ctx, fn, node->tok, "fold", true, "call to %s not folded: result %ld does not fit in int", callee->name, val);
+    return;
+  }
+  add_remark(ctx, fn, node->tok, "fold", false, "folded call to %s into %ld", callee->name, val);
+  node->kind = ND_NUM;
+  node->val = val;
+  node->args = NULL;
+  node->func = NULL;
+}
+
+// 純粋な関数の定数の引数での呼び出しをコンパイル時に評価する
+// 引数の中の呼び出しは前順で外側の呼び出しより後に現れるので、逆順に評価すれば
+// 引数を畳み込んでから外側の呼び出しを評価できる
+// build_callgraphとassign_offsetsの後に呼び出すこと
+void fold_calls(Ctx *ctx, Function *prog) {
+  find_pure(prog);
+
+  Interp ip;
+  init_interp(&ip, FOLD_FUEL, FOLD_DEPTH, FOLD_STACK);
+  CallList l = {0};
+  for (Function *fn = prog; fn; fn = fn->next) {
+    l.ncalls = 0;
+    walk_nodes(fn->node, collect_call, &l);
+    for (int i = l.ncalls - 1; i >= 0; i--)
+      fold_call(ctx, &ip, fn, l.calls[i]);
+  }
+  free(l.calls);
+  free_interp(&ip);
+}
+
+// main()を引数なしで、ノードをfuel個まで実行して戻り値を返す
+// 実行できなかった場合は、その箇所のエラーを報告する
+long run_main(Ctx *ctx, Function *prog, long fuel) {
+  Function *main_fn = NULL;
+  for (Function *fn = prog; fn && !main_fn; fn = fn->next)
+    if (!strcmp(fn->name, "main"))
+      main_fn = fn;
+  if (!main_fn)
+    error_tok(ctx, NULL, "--interp: no main function");
+
+  Interp ip;
+  init_interp(&ip, fuel, RUN_DEPTH, RUN_STACK);
+  long val = call(&ip, NULL, main_fn, NULL, 0);
+  free_interp(&ip);
+
+  if (ip.failed)
+    error_tok(ctx, ip.where ? ip.where->tok : NULL, "%s", ip.msg);
+  return val;
+}
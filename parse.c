@@ -1,10 +1,8 @@
 #include "9cc.h"
 
-VarList *locals;
-
 // すでに出現した変数があるか、nameを用いて検索する
-static Var *find_var(Token *tok) {
-  for (VarList *vl=locals; vl; vl=vl->next) {
+static Var *find_var(Ctx *ctx, Token *tok) {
+  for (VarList *vl=ctx->locals; vl; vl=vl->next) {
     Var *var = vl->var;
     if (strlen(var->name) == tok->len && !memcmp(tok->str, var->name, tok->len))
       return var;
@@ -13,330 +11,544 @@ static Var *find_var(Token *tok) {
 }
 
 // ノード生成における共通部分
-static Node *new_node(NodeKind kind, Token *tok) {
-  Node *node = calloc(1, sizeof(Node));
+static Node *new_node(Ctx *ctx, NodeKind kind, Token *tok) {
+  Node *node = new_obj(ctx, AL_NODE, sizeof(Node));
   node->kind = kind;
   node->tok = tok;
   return node;
 }
 
 // ノードを生成する（lhsもrhdも非終端記号）
-static Node *new_node_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
-  Node *node = new_node(kind, tok);
+static Node *new_node_binary(Ctx *ctx, NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
+  Node *node = new_node(ctx, kind, tok);
   node->lhs = lhs;
   node->rhs = rhs;
   return node;
 }
 
 // 数字のノード（終端記号のため、このノードの次はない）
-static Node *new_node_num(int val, Token *tok) {
-  Node *node = new_node(ND_NUM, tok);
+static Node *new_node_num(Ctx *ctx, int val, Token *tok) {
+  Node *node = new_node(ctx, ND_NUM, tok);
   node->val = val;
   return node;
 }
 
-static Node *new_node_unary(NodeKind kind, Node *expr, Token *tok) {
-  Node *node = new_node(kind, tok);
+static Node *new_node_unary(Ctx *ctx, NodeKind kind, Node *expr, Token *tok) {
+  Node *node = new_node(ctx, kind, tok);
   node->lhs = expr;
   return node;
 }
 
 // 変数を表すノード
-static Node *new_node_var(Var *var, Token *tok) {
-  Node *node = new_node(ND_VAR, tok);
+static Node *new_node_var(Ctx *ctx, Var *var, Token *tok) {
+  Node *node = new_node(ctx, ND_VAR, tok);
   node->var = var;
   return node;
 }
 
+// 代入先や"&"の対象にできるノードか確認する
+static Node *lvalue(Ctx *ctx, Node *node) {
+  if (node->kind != ND_VAR && node->kind != ND_DEREF)
+    error_tok(ctx, node->tok, "not an lvalue");
+  return node;
+}
+
 // nameの変数をスタックへpushする
 // localsにある変数をnextに入れて、*nameを新しいvarのnameへ格納（先入れ先だしを表現）
-static Var *push_var(char *name) {
-  Var *var = calloc(1, sizeof(Var));
+static Var *push_var(Ctx *ctx, char *name) {
+  Var *var = new_obj(ctx, AL_VAR, sizeof(Var));
   var->name = name;
-  VarList *vl = calloc(1, sizeof(VarList));
+  VarList *vl = new_obj(ctx, AL_VARLIST, sizeof(VarList));
   vl->var = var;
-  vl->next = locals;
-  locals = vl;
+  vl->next = ctx->locals;
+  ctx->locals = vl;
   return var;
 }
 
 // ()の中の引数をスタックへpushする
-static VarList *read_func_params(void) {
-  if (consume(")"))
+static VarList *read_func_params(Ctx *ctx) {
+  if (consume(ctx, ")"))
     return NULL;
 
-  VarList *head = calloc(1, sizeof(VarList));
-  head->var = push_var(expect_ident());
+  VarList *head = new_obj(ctx, AL_VARLIST, sizeof(VarList));
+  head->var = push_var(ctx, expect_ident(ctx));
   VarList *cur = head;
 
-  while (!consume(")")) {
-    expect(",");
-    cur->next = calloc(1, sizeof(VarList));
-    cur->next->var = push_var(expect_ident());
+  while (!consume(ctx, ")")) {
+    expect(ctx, ",");
+    cur->next = new_obj(ctx, AL_VARLIST, sizeof(VarList));
+    cur->next->var = push_var(ctx, expect_ident(ctx));
     cur = cur->next;
   }
   return head;
 }
 
-static Function *function(void);
-static Node *stmt(void);
-static Node *expr(void);
-static Node *assign(void);
-static Node *equality(void);
-static Node *relational(void);
-static Node *add(void);
-static Node *mul(void);
-static Node *unary(void);
-static Node *primary(void);
+static Function *function(Ctx *ctx);
+static Node *stmt(Ctx *ctx);
 
 // program = function*
-Function *program(void) {
+Function *program(Ctx *ctx) {
   Function head;
   head.next = NULL;
   Function *cur = &head;
 
   // 終了文字が出るまで
-  while (!at_eof()) {
-    cur->next = function();
+  for (Function *fn; (fn = next_function(ctx)); ) {
+    cur->next = fn;
     cur = cur->next;
   }
   return head.next;
 }
 
+// 式と文の解析に使うスタックを空にする。
+// スタックのメモリをrelease_objsで解放した後は、これを呼んでから次の関数をパースすること
+void reset_parser(Ctx *ctx) {
+  ctx->locals = NULL;
+  ctx->ops = NULL;
+  ctx->nops = ctx->ops_cap = 0;
+  ctx->operands = NULL;
+  ctx->noperands = ctx->operands_cap = 0;
+  ctx->frames = NULL;
+  ctx->nframes = ctx->frames_cap = 0;
+}
+
+// nodeとnextで続くノード、それらの子孫の全てのノードについてvisitを呼ぶ
+// 深くネストした木でも再帰しないように、明示的なスタックを使ってたどる
+void walk_nodes(Node *node, void (*visit)(Node *node, void *arg), void *arg) {
+  int cap = 64;
+  int n = 0;
+  Node **stack = malloc(cap * sizeof(Node *));
+  if (node)
+    stack[n++] = node;
+
+  while (n > 0) {
+    Node *nd = stack[--n];
+    visit(nd, arg);
+
+    Node *children[] = {
+      nd->next, nd->lhs, nd->rhs, nd->cond, nd->then, nd->els, nd->init, nd->inc, nd->body, nd->args,
+    };
+    for (int i = 0; i < sizeof(children) / sizeof(*children); i++) {
+      if (!children[i])
+        continue;
+      if (n == cap) {
+        cap *= 2;
+        stack = realloc(stack, cap * sizeof(Node *));
+      }
+      stack[n++] = children[i];
+    }
+  }
+  free(stack);
+}
+
+// 次の関数を1つパースして返す。入力の終わりならNULLを返す
+Function *next_function(Ctx *ctx) {
+  if (at_eof(ctx))
+    return NULL;
+  return function(ctx);
+}
+
 // function = ident "(" params? ")" "{" stmt* "}"
 // params   = ident ("," ident)*
-Function *function(void) {
-  locals = NULL;
+static Function *function(Ctx *ctx) {
+  ctx->locals = NULL;
 
-  Function *fn = calloc(1, sizeof(Function));
-  fn->name = expect_ident();
-  expect("(");
-  fn->params = read_func_params();
-  expect("{");
+  Function *fn = new_obj(ctx, AL_FUNCTION, sizeof(Function));
+  fn->tok = ctx->token;
+  fn->scc = -1;
+  fn->name = expect_ident(ctx);
+  expect(ctx, "(");
+  fn->params = read_func_params(ctx);
+  expect(ctx, "{");
 
   Node head;
   head.next = NULL;
   Node *cur = &head;
-  while (!consume("}")) {
-    cur->next = stmt();
+  while (!consume(ctx, "}")) {
+    cur->next = stmt(ctx);
     cur = cur->next;
   }
 
   fn->node = head.next;
-  fn->locals = locals;
+  fn->locals = ctx->locals;
   return fn;
 }
 
-// stmt = "return" expr ";"
-//        | "if" "(" expr ")" stmt ("else" stmt)?
-//        | "while" "(" expr ")" stmt
-//        | "for" "(" expr? ";" expr? ";" expr? ")" stmt
-//        | "{" stmt* "}"
-//        | expr ";"
-static Node *stmt(void) {
+/**
+ * 文と式の解析
+ *
+ * 入力が深くネストしていてもCのスタックを使い切らないように、再帰下降ではなく
+ * ctxの中の明示的なスタックを使って解析する。
+ * ネストの深さ（スタックの要素数の合計）がctx->max_depthを超えたらエラーにする。
+ */
+
+// 式の解析で演算子スタックに積む要素の種類
+typedef enum {
+  OP_BINARY, // 二項演算子
+  OP_PREFIX, // 前置の単項演算子
+  OP_PAREN,  // "(" expr ")"の"("
+  OP_CALL,   // 関数呼び出しの"("
+} OpType;
+
+struct Op {
+  OpType type;
+  int prec;       // 優先順位。大きいほど強く結合する。括弧は0
+  NodeKind kind;  // OP_BINARYの場合のノードの種類
+  bool swap;      // ">"と">="は左右を入れ替えて"<"と"<="にする
   Token *tok;
-  if (tok = consume("return")) {
-    Node *node = new_node_unary(ND_RETURN, expr(), tok);
-    expect(";");
-    return node;
-  }
-  if (tok = consume("if")) {
-    Node *node = new_node(ND_IF, tok);
-    expect("(");
-    node->cond = expr();
-    expect(")");
-    node->then = stmt();
-    if (consume("else"))
-      node->els = stmt();
-    return node;
-  }
-  if (tok = consume("while")) {
-    Node *node = new_node(ND_WHILE, tok);
-    expect("(");
-    node->cond = expr();
-    expect(")");
-    node->then = stmt();
-    return node;
-  }
-  if (tok = consume("for")) {
-    Node *node = new_node(ND_FOR, tok);
-    expect("(");
-    // カウンタ変数
-    if (!consume(";")) {
-      node->init = new_node_unary(ND_EXPR_STMT, expr(), tok);
-      expect(";");
-    }
-    // 条件
-    if (!consume(";")) {
-      node->cond = expr();
-      expect(";");
-    }
-    // インクリメント
-    if (!consume(")")) {
-      node->inc = new_node_unary(ND_EXPR_STMT, expr(), tok);
-      expect(")");
-    }
-    node->then = stmt();
-    return node;
-  }
-
-  // ブロックを確認
-  if (tok = consume("{")) {
-    Node head;
-    head.next = NULL;
-    Node *cur = &head;
-
-    while (!consume("}")) {
-      cur->next = stmt();
-      cur = cur->next;
-    }
+  Node *call;     // OP_CALLの場合のND_FUNCALLノード
+  Node *last_arg; // OP_CALLの場合の最後の引数
+  int outer;      // OP_PARENとOP_CALLの場合、1つ外側の括弧の位置
+};
+
+// 文の解析で、子の文を待っている文
+struct StmtFrame {
+  Node *node;  // ND_IF, ND_WHILE, ND_FOR, ND_BLOCKのいずれか
+  Node *last;  // ND_BLOCKの場合の最後の文
+};
+
+#define PREC_ASSIGN 1
+#define PREC_PREFIX 6
+
+// 二項演算子。"="だけは右結合
+static struct {
+  char *op;
+  NodeKind kind;
+  int prec;
+  bool swap;
+} binops[] = {
+  {"=", ND_ASSIGN, PREC_ASSIGN},
+  {"==", ND_EQ, 2}, {"!=", ND_NE, 2},
+  {"<", ND_LT, 3}, {"<=", ND_LE, 3}, {">", ND_LT, 3, true}, {">=", ND_LE, 3, true},
+  {"+", ND_ADD, 4}, {"-", ND_SUB, 4},
+  {"*", ND_MUL, 5}, {"/", ND_DIV, 5},
+};
+
+// スタックの容量が足りなければ2倍に広げた領域を返す
+static void *grow(Ctx *ctx, void *buf, int *cap, int len, size_t size) {
+  if (len < *cap)
+    return buf;
+  int newcap = *cap ? *cap * 2 : 64;
+  void *p = new_obj(ctx, AL_STACK, newcap * size);
+  if (len)
+    memcpy(p, buf, len * size);
+  *cap = newcap;
+  return p;
+}
 
-    Node *node = new_node(ND_BLOCK, tok);
-    node->body = head.next;
-    return node;
-  }
-  Node *node = new_node_unary(ND_EXPR_STMT, expr(), tok);
-  expect(";");
-  return node;
+// ネストが深すぎないか確認する
+static void check_depth(Ctx *ctx, Token *tok) {
+  if (ctx->nops + ctx->nframes >= ctx->max_depth)
+    error_tok(ctx, tok, "nesting too deep (limit is %d, see --max-depth)", ctx->max_depth);
 }
 
-// expr = assign
-static Node *expr(void) {
-  return assign();
+static void push_op(Ctx *ctx, Op op) {
+  check_depth(ctx, op.tok);
+  ctx->ops = grow(ctx, ctx->ops, &ctx->ops_cap, ctx->nops, sizeof(Op));
+  ctx->ops[ctx->nops++] = op;
 }
 
-// assign = equality ("=" assign)?
-static Node *assign(void) {
-  Node *node = equality();
-  Token *tok;
+// 括弧か関数呼び出しの"("を積む
+static void push_paren(Ctx *ctx, OpType type, Token *tok, Node *call) {
+  push_op(ctx, (Op){.type = type, .tok = tok, .call = call, .outer = ctx->paren});
+  ctx->paren = ctx->nops - 1;
+}
 
-  if (tok = consume("="))
-    node = new_node_binary(ND_ASSIGN, node, assign(), tok);
-  return node;
+static void push_operand(Ctx *ctx, Node *node) {
+  ctx->operands = grow(ctx, ctx->operands, &ctx->operands_cap, ctx->noperands, sizeof(Node *));
+  ctx->operands[ctx->noperands++] = node;
 }
 
-// equality = relational ("==" relational | "!=" relational)*
-static Node *equality(void) {
-  Node *node = relational();
-  Token *tok;
+static Node *pop_operand(Ctx *ctx) {
+  return ctx->operands[--ctx->noperands];
+}
 
-  for (;;) {
-    if (tok = consume("=="))
-      node = new_node_binary(ND_EQ, node, relational(), tok);
-    else if (tok = consume("!="))
-      node = new_node_binary(ND_NE, node, relational(), tok);
-    else
-      return node;
+// 演算子スタックの一番上の演算子を取り出し、オペランドと合わせてノードにする
+static void reduce(Ctx *ctx) {
+  Op op = ctx->ops[--ctx->nops];
+
+  if (op.type == OP_PREFIX) {
+    Node *expr = pop_operand(ctx);
+    switch (*op.tok->str) {
+    case '+':
+      push_operand(ctx, expr);
+      return;
+    case '-':
+      // 負の数の場合は、左辺に0を入れて0-xとして表現
+      push_operand(ctx, new_node_binary(ctx, ND_SUB, new_node_num(ctx, 0, op.tok), expr, op.tok));
+      return;
+    case '&':
+      push_operand(ctx, new_node_unary(ctx, ND_ADDR, lvalue(ctx, expr), op.tok));
+      return;
+    case '*':
+      push_operand(ctx, new_node_unary(ctx, ND_DEREF, expr, op.tok));
+      return;
+    }
   }
+
+  Node *rhs = pop_operand(ctx);
+  Node *lhs = pop_operand(ctx);
+  if (op.kind == ND_ASSIGN)
+    lvalue(ctx, lhs);
+  if (op.swap)
+    push_operand(ctx, new_node_binary(ctx, op.kind, rhs, lhs, op.tok));
+  else
+    push_operand(ctx, new_node_binary(ctx, op.kind, lhs, rhs, op.tok));
 }
 
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-static Node *relational(void) {
-  Node *node = add();
-  Token *tok;
+// 一番内側の括弧の中の演算子を全てノードにする
+static void reduce_paren(Ctx *ctx) {
+  while (ctx->nops - 1 > ctx->paren)
+    reduce(ctx);
+}
 
-  for (;;) {
-    if (tok = consume("<"))
-      node = new_node_binary(ND_LT, node , add(), tok);
-    else if (tok = consume("<="))
-      node = new_node_binary(ND_LE, node, add(), tok);
-    else if (tok = consume(">"))
-      node = new_node_binary(ND_LT, add(), node, tok);
-    else if (tok = consume(">="))
-      node = new_node_binary(ND_LE, add(), node, tok);
-    else 
-      return node;
-  }
+// 一番内側の括弧を取り除く
+static Op pop_paren(Ctx *ctx) {
+  Op op = ctx->ops[--ctx->nops];
+  ctx->paren = op.outer;
+  return op;
 }
 
-// add = mul ("+" mul | "-" mul)*
-static Node *add(void) {
-  Node *node = mul();
-  Token *tok;
+// 関数呼び出しの引数を1つ追加する
+static void add_arg(Ctx *ctx) {
+  Op *op = &ctx->ops[ctx->paren];
+  Node *arg = pop_operand(ctx);
+  if (op->last_arg)
+    op->last_arg->next = arg;
+  else
+    op->call->args = arg;
+  op->last_arg = arg;
+}
 
+// unary   = ("+" | "-" | "*" | "&")? unary
+//         | primary
+// primary = num | "(" expr ")" | ident func-args?
+//
+// オペランドを1つ読んでオペランドスタックに積む。
+// 前置演算子と"("、引数のある関数呼び出しは演算子スタックに積んで読み進める。
+static void operand(Ctx *ctx) {
   for (;;) {
-    if (tok = consume("+"))
-      node = new_node_binary(ND_ADD, node, mul(), tok);
-    else if (tok = consume("-"))
-      node = new_node_binary(ND_SUB, node, mul(), tok);
-    else
-      return node;
-  }
-}
+    Token *tok;
+    if ((tok = consume(ctx, "+")) || (tok = consume(ctx, "-")) ||
+        (tok = consume(ctx, "&")) || (tok = consume(ctx, "*"))) {
+      push_op(ctx, (Op){.type = OP_PREFIX, .prec = PREC_PREFIX, .tok = tok});
+      continue;
+    }
+    if ((tok = consume(ctx, "("))) {
+      push_paren(ctx, OP_PAREN, tok, NULL);
+      continue;
+    }
 
-// mul = unary ("*" unary | "/" unary)*
-static Node *mul(void) {
-  Node *node = unary();
-  Token *tok;
+    if ((tok = consume_ident(ctx))) {
+      if (consume(ctx, "(")) {
+        Node *node = new_node(ctx, ND_FUNCALL, tok);
+        node->funcname = my_strndup(ctx, tok->str, tok->len);
+        if (consume(ctx, ")")) {
+          push_operand(ctx, node);
+          return;
+        }
+        push_paren(ctx, OP_CALL, tok, node);
+        continue;
+      }
+      Var *var = find_var(ctx, tok);
+      if (!var)
+        var = push_var(ctx, my_strndup(ctx, tok->str, tok->len));
+      push_operand(ctx, new_node_var(ctx, var, tok));
+      return;
+    }
 
-  for (;;) {
-    if (tok = consume("*"))
-      node = new_node_binary(ND_MUL, node, unary(), tok);
-    else if (tok = consume("/"))
-      node = new_node_binary(ND_DIV, node, unary(), tok);
-    else
-      return node;
+    // そうでなければ数値
+    tok = ctx->token;
+    if (tok->kind != TK_NUM)
+      error_tok(ctx, tok, "expected expression");
+    push_operand(ctx, new_node_num(ctx, expect_number(ctx), tok));
+    return;
   }
 }
 
-// unary = ("+" | "-" | "*" | "&")? unary
-//        | primary
-static Node *unary(void) {
-  Token *tok;
-  if (tok = consume("+"))
-    return unary();
-  if (tok = consume("-"))
-    // 負の数の場合は、左辺に0を入れて0-xとして表現
-    return new_node_binary(ND_SUB, new_node_num(0, tok), unary(), tok);
-  if (tok = consume("&"))
-    return new_node_unary(ND_ADDR, unary(), tok);
-  if (tok = consume("*"))
-    return new_node_unary(ND_DEREF, unary(), tok);
-  return primary();
-}
+// func-args = "(" (assign ("," assign)*)? ")"
+//
+// オペランドの後の二項演算子か、括弧や関数呼び出しの閉じ括弧を読む。
+// 次にオペランドが必要ならtrue、式が終わりならfalseを返す。
+static bool operator(Ctx *ctx) {
+  for (;;) {
+    for (int i = 0; i < sizeof(binops) / sizeof(*binops); i++) {
+      Token *tok = consume(ctx, binops[i].op);
+      if (!tok)
+        continue;
+
+      // 優先順位が同じか高い演算子を先にノードにする（"="は右結合なので同じ場合はしない）
+      int prec = binops[i].prec;
+      while (ctx->nops > ctx->paren + 1) {
+        int top = ctx->ops[ctx->nops - 1].prec;
+        if (top < prec || (top == prec && prec == PREC_ASSIGN))
+          break;
+        reduce(ctx);
+      }
+      push_op(ctx, (Op){.type = OP_BINARY, .prec = prec, .kind = binops[i].kind,
+                        .swap = binops[i].swap, .tok = tok});
+      return true;
+    }
 
-// func_args = "(" (assign ("," assign)*)? ")"
-static Node *func_args(void) {
-  if (consume(")"))
-    return NULL;
+    Op *paren = ctx->paren >= 0 ? &ctx->ops[ctx->paren] : NULL;
+    if (paren && paren->type == OP_PAREN && consume(ctx, ")")) {
+      reduce_paren(ctx);
+      pop_paren(ctx);
+      continue;
+    }
+    if (paren && paren->type == OP_CALL) {
+      if (consume(ctx, ",")) {
+        reduce_paren(ctx);
+        add_arg(ctx);
+        return true;
+      }
+      if (consume(ctx, ")")) {
+        reduce_paren(ctx);
+        add_arg(ctx);
+        push_operand(ctx, pop_paren(ctx).call);
+        continue;
+      }
+    }
 
-  Node *head = assign();
-  Node *cur = head;
-  while(consume(",")) {
-    cur->next = assign();
-    cur = cur->next;
+    if (paren)
+      expect(ctx, ")");
+    return false;
   }
-  expect(")");
-  return head;
 }
 
+// expr       = assign
+// assign     = equality ("=" assign)?
+// equality   = relational ("==" relational | "!=" relational)*
+// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
+// add        = mul ("+" mul | "-" mul)*
+// mul        = unary ("*" unary | "/" unary)*
+//
+// 演算子の優先順位を使って、演算子スタックとオペランドスタックで解析する
+static Node *expr(Ctx *ctx) {
+  int base = ctx->nops;
+  int outer = ctx->paren;
+  ctx->paren = base - 1;
+
+  do {
+    operand(ctx);
+  } while (operator(ctx));
+
+  while (ctx->nops > base)
+    reduce(ctx);
+  ctx->paren = outer;
+  return pop_operand(ctx);
+}
+
+static void push_frame(Ctx *ctx, Node *node) {
+  check_depth(ctx, node->tok);
+  ctx->frames = grow(ctx, ctx->frames, &ctx->frames_cap, ctx->nframes, sizeof(StmtFrame));
+  ctx->frames[ctx->nframes++] = (StmtFrame){.node = node};
+}
 
-// primary = num | "(" expr ")" | indent func-args?
-static Node *primary(void) {
-  // 次のトークンが"("なら、"(" expr ")"のはず
-  if (consume("(")) {
-    Node *node = expr();
-    expect(")");
+// 文の先頭を読む。
+// 子の文を持たない文ならそのノードを返す。子の文を持つ文ならスタックに積んでNULLを返す。
+static Node *stmt_head(Ctx *ctx) {
+  Token *tok;
+  if (tok = consume(ctx, "return")) {
+    Node *node = new_node_unary(ctx, ND_RETURN, expr(ctx), tok);
+    expect(ctx, ";");
     return node;
   }
+  if (tok = consume(ctx, "if")) {
+    Node *node = new_node(ctx, ND_IF, tok);
+    expect(ctx, "(");
+    node->cond = expr(ctx);
+    expect(ctx, ")");
+    push_frame(ctx, node);
+    return NULL;
+  }
+  if (tok = consume(ctx, "while")) {
+    Node *node = new_node(ctx, ND_WHILE, tok);
+    expect(ctx, "(");
+    node->cond = expr(ctx);
+    expect(ctx, ")");
+    push_frame(ctx, node);
+    return NULL;
+  }
+  if (tok = consume(ctx, "for")) {
+    Node *node = new_node(ctx, ND_FOR, tok);
+    expect(ctx, "(");
+    // カウンタ変数
+    if (!consume(ctx, ";")) {
+      node->init = new_node_unary(ctx, ND_EXPR_STMT, expr(ctx), tok);
+      expect(ctx, ";");
+    }
+    // 条件
+    if (!consume(ctx, ";")) {
+      node->cond = expr(ctx);
+      expect(ctx, ";");
+    }
+    // インクリメント
+    if (!consume(ctx, ")")) {
+      node->inc = new_node_unary(ctx, ND_EXPR_STMT, expr(ctx), tok);
+      expect(ctx, ")");
+    }
+    push_frame(ctx, node);
+    return NULL;
+  }
 
-  Token *tok;
-  if (tok = consume_ident()) {
-    if (consume("(")) {
-      Node *node = new_node(ND_FUNCALL, tok);
-      node->funcname = my_strndup(tok->str, tok->len);
-      node->args = func_args();
+  // ブロックを確認
+  if (tok = consume(ctx, "{")) {
+    Node *node = new_node(ctx, ND_BLOCK, tok);
+    if (consume(ctx, "}"))
       return node;
-    }
-    Var *var = find_var(tok);
-    if (!var)
-      var = push_var(my_strndup(tok->str, tok->len));
-    return new_node_var(var, tok);
+    push_frame(ctx, node);
+    return NULL;
   }
+  Node *node = new_node_unary(ctx, ND_EXPR_STMT, expr(ctx), tok);
+  expect(ctx, ";");
+  return node;
+}
 
-  // そうでなければ数値
-  tok = token;
-  if (tok->kind != TK_NUM)
-    error_tok(tok, "expected expression");
-  return new_node_num(expect_number(), tok);
+// stmt = "return" expr ";"
+//        | "if" "(" expr ")" stmt ("else" stmt)?
+//        | "while" "(" expr ")" stmt
+//        | "for" "(" expr? ";" expr? ";" expr? ")" stmt
+//        | "{" stmt* "}"
+//        | expr ";"
+//
+// 子の文を待っている文をスタックに積み、子の文ができたら親の文に渡していく
+static Node *stmt(Ctx *ctx) {
+  int base = ctx->nframes;
+
+  for (;;) {
+    Node *node = stmt_head(ctx);
+    if (!node)
+      continue;
+
+    for (;;) {
+      if (ctx->nframes == base)
+        return node;
+
+      StmtFrame *frame = &ctx->frames[ctx->nframes - 1];
+      Node *parent = frame->node;
+
+      if (parent->kind == ND_BLOCK) {
+        if (frame->last)
+          frame->last->next = node;
+        else
+          parent->body = node;
+        frame->last = node;
+        if (!consume(ctx, "}"))
+          break; // ブロックの次の文を読む
+      } else if (parent->kind == ND_IF && !parent->then) {
+        parent->then = node;
+        if (consume(ctx, "else"))
+          break; // elseの文を読む
+      } else if (parent->kind == ND_IF) {
+        parent->els = node;
+      } else {
+        parent->then = node;
+      }
+
+      // 親の文ができたので、さらにその親に渡す
+      ctx->nframes--;
+      node = parent;
+    }
+  }
 }
@@ -0,0 +1,126 @@
+#include "9cc.h"
+
+/**
+ * 最適化のリマーク
+ *
+ * --remarksの場合、各パスは最適化を適用した箇所と見送った箇所をその理由と一緒にRemarkに記録する。
+ * 関数ごとに、コード生成で数えた命令の数などと一緒に出力する。
+ */
+
+// fnにtokの箇所のRemarkを追加する。ctx->opt.remarksがfalseなら何もしない
+// リストはtokの位置の順に保つので、パスの実行順によらずソースの順に出力される
+void add_remark(Ctx *ctx, Function *fn, Token *tok, char *pass, bool missed, char *fmt, ...) {
+  if (!ctx->opt.remarks)
+    return;
+
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+
+  Remark *r = new_obj(ctx, AL_REMARK, sizeof(Remark));
+  r->pass = pass;
+  r->missed = missed;
+  r->tok = tok ? tok : fn->tok;
+  r->msg = new_obj(ctx, AL_STRING, len + 1);
+  va_start(ap, fmt);
+  vsnprintf(r->msg, len + 1, fmt, ap);
+  va_end(ap);
+
+  Remark **p = &fn->remarks;
+  while (*p && (*p)->tok->str <= r->tok->str)
+    p = &(*p)->next;
+  r->next = *p;
+  *p = r;
+}
+
+// tokの桁番号（1から）を返す
+static int column(Ctx *ctx, Token *tok) {
+  char *line = tok->str;
+  while (ctx->user_input < line && line[-1] != '\n')
+    line--;
+  return tok->str - line + 1;
+}
+
+// sを"と\\をエスケープしたJSONの文字列として出力する
+static void print_json_string(FILE *out, char *s) {
+  putc('"', out);
+  for (char *p = s; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      putc('\\', out);
+    putc(*p, out);
+  }
+  putc('"', out);
+}
+
+static void print_remarks_text(Ctx *ctx, Function *fn, FILE *out, bool removed) {
+  char *file = ctx->filename ? ctx->filename : "-";
+  fprintf(out, "%s:%d: %s: ", file, fn->tok->line_no, fn->name);
+  if (removed) {
+    fprintf(out, "removed\n");
+  } else {
+    fprintf(out, "%d instructions (%d push, %d pop), frame %d bytes (%d locals in %d slots), %d calls, %d alignment checks",
+            fn->ninsns, fn->npush, fn->npop, fn->stack_size, fn->nlocals, fn->nslots, fn->ncalls, fn->nalign_checks);
+    if (fn->scc >= 0)
+      fprintf(out, ", scc %d%s", fn->scc, fn->recursive ? ", recursive" : "");
+    fprintf(out, "\n");
+  }
+
+  for (Remark *r = fn->remarks; r; r = r->next)
+    fprintf(out, "%s:%d:%d: %s: %s: %s\n", file, r->tok->line_no, column(ctx, r->tok),
+            r->missed ? "missed" : "remark", r->pass, r->msg);
+}
+
+// 1つの関数を1行のJSONで出力する
+static void print_remarks_json(Ctx *ctx, Function *fn, FILE *out, bool removed) {
+  fprintf(out, "{");
+  if (ctx->filename) {
+    fprintf(out, "\"file\":");
+    print_json_string(out, ctx->filename);
+    fprintf(out, ",");
+  }
+  fprintf(out, "\"function\":\"%s\",\"line\":%d", fn->name, fn->tok->line_no);
+  if (removed)
+    fprintf(out, ",\"removed\":true");
+  else
+    fprintf(out, ",\"instructions\":%d,\"push\":%d,\"pop\":%d,\"frame_size\":%d,\"locals\":%d,\"slots\":%d,\"calls\":%d,\"alignment_checks\":%d",
+            fn->ninsns, fn->npush, fn->npop, fn->stack_size, fn->nlocals, fn->nslots, fn->ncalls, fn->nalign_checks);
+  if (fn->scc >= 0)
+    fprintf(out, ",\"scc\":%d,\"recursive\":%s", fn->scc, fn->recursive ? "true" : "false");
+
+  fprintf(out, ",\"remarks\":[");
+  for (Remark *r = fn->remarks; r; r = r->next) {
+    fprintf(out, "%s{\"pass\":\"%s\",\"kind\":\"%s\",\"line\":%d,\"column\":%d,\"message\":",
+            r == fn->remarks ? "" : ",", r->pass, r->missed ? "missed" : "applied",
+            r->tok->line_no, column(ctx, r->tok));
+    print_json_string(out, r->msg);
+    fprintf(out, "}");
+  }
+  fprintf(out, "]}\n");
+}
+
+// fnの出力をバッファに作ってからoutへまとめて書き出す
+// stderrはバッファリングされないので、1文字ずつ書くとその度にシステムコールになる
+static void print_function(Ctx *ctx, Function *fn, FILE *out, bool json, bool removed) {
+  char *buf;
+  size_t len;
+  FILE *fp = open_memstream(&buf, &len);
+  if (json)
+    print_remarks_json(ctx, fn, fp, removed);
+  else
+    print_remarks_text(ctx, fn, fp, removed);
+  fclose(fp);
+  fwrite(buf, 1, len, out);
+  free(buf);
+}
+
+// --remarksで指定された形式で、コード生成の終わったfnの統計とRemarkを出力する
+void print_remarks(Ctx *ctx, Function *fn, FILE *out, bool json) {
+  print_function(ctx, fn, out, json, false);
+}
+
+// --whole-programで取り除いた関数とそのRemarkを出力する
+void print_removed(Ctx *ctx, FILE *out, bool json) {
+  for (Function *fn = ctx->removed; fn; fn = fn->next)
+    print_function(ctx, fn, out, json, true);
+}
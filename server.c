@@ -0,0 +1,199 @@
+#include "9cc.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * コンパイルサーバ
+ *
+ * 1つのプロセスでリクエストを繰り返し受け付けてコンパイルする。
+ * リクエストとレスポンスはどちらも1行のヘッダと、それに続く本文からなる。
+ *
+ *   request  = "compile" (" " option)* " " length "\n" source
+ *   response = ("ok" | "error") " " length [" " report-length] "\n" body [report]
+ *
+ * lengthは本文のバイト数で、MAX_SOURCEまで。optionは"file=NAME"か、
+ * --statsなどコマンドライン引数と同じコンパイルごとのオプション（parse_optionが解釈するもの）。
+ * file=NAMEはエラーメッセージに表示するファイル名を指定する。
+ * 他のoptionはサーバの起動時のオプションに加えて、そのリクエストだけに使う。
+ * okの本文はアセンブリ、errorの本文はエラーメッセージ。
+ * --statsなどの出力があれば、report-lengthバイトのreportとして本文の後に続ける。
+ * リクエストごとに新しいCtxを作り、終わったら全て解放する。
+ */
+
+// リクエストの本文の長さの上限。これより長いリクエストにはエラーを返して接続を閉じる
+#define MAX_SOURCE (64 << 20)
+
+static void respond(FILE *out, bool ok, char *body, size_t len, char *report, size_t report_len) {
+  if (report_len)
+    fprintf(out, "%s %zu %zu\n", ok ? "ok" : "error", len, report_len);
+  else
+    fprintf(out, "%s %zu\n", ok ? "ok" : "error", len);
+  fwrite(body, 1, len, out);
+  fwrite(report, 1, report_len, out);
+  fflush(out);
+}
+
+static void respond_error(FILE *out, char *msg) {
+  respond(out, false, msg, strlen(msg), NULL, 0);
+}
+
+// srcをoptionsのオプションでコンパイルしてレスポンスを返す
+static void compile_request(FILE *out, char *filename, char **options, int noptions, char *src) {
+  Ctx *ctx = calloc(1, sizeof(Ctx));
+  init_options(ctx);
+  for (int i = 0; i < noptions; i++) {
+    if (!parse_option(ctx, options[i])) {
+      char msg[256];
+      snprintf(msg, sizeof(msg), "unknown option: %s\n", options[i]);
+      respond_error(out, msg);
+      free_objs(ctx);
+      free(ctx);
+      return;
+    }
+  }
+  ctx->filename = filename;
+  ctx->user_input = src;
+
+  char *asm_buf, *err_buf, *report_buf;
+  size_t asm_len, err_len, report_len;
+  ctx->out = open_memstream(&asm_buf, &asm_len);
+  ctx->err = open_memstream(&err_buf, &err_len);
+  ctx->report = open_memstream(&report_buf, &report_len);
+
+  jmp_buf buf;
+  ctx->on_error = &buf;
+  bool ok = false;
+  if (setjmp(buf) == 0) {
+    compile(ctx);
+    ok = true;
+  }
+
+  fclose(ctx->out);
+  fclose(ctx->err);
+  fclose(ctx->report);
+  if (ok)
+    respond(out, true, asm_buf, asm_len, report_buf, report_len);
+  else
+    respond(out, false, err_buf, err_len, report_buf, report_len);
+
+  free(asm_buf);
+  free(err_buf);
+  free(report_buf);
+  free_objs(ctx);
+  free(ctx);
+}
+
+// リクエストを1つ処理する。入力が終わったか、ヘッダが壊れていればfalseを返す
+static bool handle_request(FILE *in, FILE *out) {
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n = getline(&line, &cap, in);
+  if (n <= 0) {
+    free(line);
+    return false;
+  }
+  if (line[n - 1] == '\n')
+    line[n - 1] = '\0';
+
+  // ヘッダを空白で区切って読む。最後の要素が本文の長さで、その前がオプション
+  char *save;
+  char *word = strtok_r(line, " ", &save);
+  if (!word || strcmp(word, "compile")) {
+    respond_error(out, "expected \"compile\"\n");
+    free(line);
+    return false;
+  }
+  char **words = calloc(n, sizeof(char *));
+  int nwords = 0;
+  while ((word = strtok_r(NULL, " ", &save)))
+    words[nwords++] = word;
+
+  char *filename = NULL;
+  char **options = calloc(n, sizeof(char *));
+  int noptions = 0;
+  for (int i = 0; i < nwords - 1; i++) {
+    if (!strncmp(words[i], "file=", 5))
+      filename = words[i] + 5;
+    else
+      options[noptions++] = words[i];
+  }
+
+  char *end;
+  errno = 0;
+  long len = nwords ? strtol(words[nwords - 1], &end, 10) : -1;
+  char *msg = NULL;
+  char *src = NULL;
+  if (len < 0 || *end || errno)
+    msg = "invalid request length\n";
+  else if (len > MAX_SOURCE)
+    msg = "request too large\n";
+  else if (!(src = malloc(len + 1)))
+    msg = "out of memory\n";
+  else if (fread(src, 1, len, in) != len)
+    msg = "truncated request\n";
+
+  if (msg) {
+    // 本文を読み飛ばせないので、エラーを返して接続を閉じる
+    respond_error(out, msg);
+  } else {
+    src[len] = '\0';
+    compile_request(out, filename, options, noptions, src);
+  }
+
+  free(src);
+  free(words);
+  free(options);
+  free(line);
+  return !msg;
+}
+
+// inからのリクエストがなくなるまで処理する
+static void serve(FILE *in, FILE *out) {
+  while (handle_request(in, out))
+    ;
+}
+
+// Unixドメインソケットpathで接続を1つずつ受け付ける
+static void serve_socket(char *path) {
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    error("%s: socket path too long", path);
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    error("socket: %s", strerror(errno));
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    error("%s: %s", path, strerror(errno));
+  if (listen(fd, 16) < 0)
+    error("listen: %s", strerror(errno));
+
+  for (;;) {
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR)
+        continue;
+      error("accept: %s", strerror(errno));
+    }
+    FILE *in = fdopen(conn, "r");
+    FILE *out = fdopen(dup(conn), "w");
+    serve(in, out);
+    fclose(in);
+    fclose(out);
+  }
+}
+
+// pathがNULLなら標準入出力で、そうでなければUnixドメインソケットでリクエストを受け付ける
+void run_server(char *path) {
+  // クライアントが途中で切断してもサーバを終了しない
+  signal(SIGPIPE, SIG_IGN);
+
+  if (path)
+    serve_socket(path);
+  else
+    serve(stdin, stdout);
+}
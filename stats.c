@@ -0,0 +1,145 @@
+#include "9cc.h"
+#include <sys/resource.h>
+#include <time.h>
+
+static char *alloc_name[] = {"token", "node", "var", "varlist", "function", "string", "stack", "callgraph", "remark"};
+static char *phase_name[] = {"tokenize", "parse", "callgraph", "offset", "fold", "interp", "codegen"};
+
+// モノトニッククロックの現在時刻をナノ秒で返す
+static long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// callocと同じだが、構造体の種類ごとに確保数とバイト数を数える
+// メモリはctxのChunkから切り出すので、free_objsでまとめて解放できる
+void *new_obj(Ctx *ctx, AllocKind kind, size_t size) {
+  size_t aligned = (size + 7) & ~(size_t)7;
+  Chunk *c = ctx->chunks;
+  if (!c || c->cap - c->used < aligned) {
+    size_t cap = aligned > 65536 ? aligned : 65536;
+    c = calloc(1, sizeof(Chunk) + cap);
+    if (!c)
+      error("out of memory");
+    c->cap = cap;
+    c->next = ctx->chunks;
+    ctx->chunks = c;
+  }
+
+  void *p = c->buf + c->used;
+  c->used += aligned;
+  ctx->stats.alloc_count[kind]++;
+  ctx->stats.alloc_bytes[kind] += size;
+  return p;
+}
+
+// new_objで確保したメモリを全て解放する
+void free_objs(Ctx *ctx) {
+  for (Chunk *c = ctx->chunks, *next; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  ctx->chunks = NULL;
+}
+
+// 今までにnew_objで確保した位置を返す
+ObjMark mark_objs(Ctx *ctx) {
+  return (ObjMark){ctx->chunks, ctx->chunks ? ctx->chunks->used : 0};
+}
+
+// markより後にnew_objで確保したメモリを解放する
+void release_objs(Ctx *ctx, ObjMark mark) {
+  while (ctx->chunks != mark.chunk) {
+    Chunk *c = ctx->chunks;
+    ctx->chunks = c->next;
+    free(c);
+  }
+
+  // new_objはゼロで初期化したメモリを返すので、再利用する部分はゼロに戻す
+  Chunk *c = ctx->chunks;
+  if (c) {
+    memset(c->buf + mark.used, 0, c->used - mark.used);
+    c->used = mark.used;
+  }
+}
+
+void phase_begin(Ctx *ctx, Phase ph) {
+  ctx->stats.phase_start[ph] = now_ns();
+}
+
+void phase_end(Ctx *ctx, Phase ph) {
+  ctx->stats.phase_ns[ph] += now_ns() - ctx->stats.phase_start[ph];
+}
+
+// ピークRSSをKBで返す
+static long peak_rss_kb(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+static void print_stats_text(Ctx *ctx, FILE *out) {
+  Stats *st = &ctx->stats;
+  long total_ns = 0;
+  long total_bytes = 0;
+
+  if (ctx->filename)
+    fprintf(out, "file: %s\n", ctx->filename);
+  fprintf(out, "phase          time(ms)\n");
+  for (int i = 0; i < PH_NPHASE; i++) {
+    fprintf(out, "  %-12s %9.3f\n", phase_name[i], st->phase_ns[i] / 1e6);
+    total_ns += st->phase_ns[i];
+  }
+  fprintf(out, "  %-12s %9.3f\n", "total", total_ns / 1e6);
+
+  fprintf(out, "object          count       bytes\n");
+  for (int i = 0; i < AL_NKIND; i++) {
+    fprintf(out, "  %-12s %7ld %11ld\n", alloc_name[i], st->alloc_count[i], st->alloc_bytes[i]);
+    total_bytes += st->alloc_bytes[i];
+  }
+  fprintf(out, "  %-12s %7s %11ld\n", "total", "", total_bytes);
+  fprintf(out, "peak rss: %ld KB\n", peak_rss_kb());
+}
+
+static void print_stats_json(Ctx *ctx, FILE *out) {
+  Stats *st = &ctx->stats;
+  long total_ns = 0;
+
+  fprintf(out, "{");
+  if (ctx->filename) {
+    fprintf(out, "\"file\":\"");
+    for (char *p = ctx->filename; *p; p++)
+      fprintf(out, (*p == '"' || *p == '\\') ? "\\%c" : "%c", *p);
+    fprintf(out, "\",");
+  }
+  fprintf(out, "\"phases_ns\":{");
+  for (int i = 0; i < PH_NPHASE; i++) {
+    fprintf(out, "%s\"%s\":%ld", i ? "," : "", phase_name[i], st->phase_ns[i]);
+    total_ns += st->phase_ns[i];
+  }
+  fprintf(out, ",\"total\":%ld}", total_ns);
+
+  fprintf(out, ",\"counts\":{");
+  for (int i = 0; i < AL_NKIND; i++)
+    fprintf(out, "%s\"%s\":%ld", i ? "," : "", alloc_name[i], st->alloc_count[i]);
+  fprintf(out, "}");
+
+  fprintf(out, ",\"bytes\":{");
+  for (int i = 0; i < AL_NKIND; i++)
+    fprintf(out, "%s\"%s\":%ld", i ? "," : "", alloc_name[i], st->alloc_bytes[i]);
+  fprintf(out, "}");
+
+  fprintf(out, ",\"peak_rss_kb\":%ld}\n", peak_rss_kb());
+}
+
+// --statsで指定された形式で統計を出力する
+// ファイルから読み込んだ入力の場合は、ファイル名も出力する
+void print_stats(Ctx *ctx, FILE *out, bool json) {
+  flockfile(out);
+  if (json)
+    print_stats_json(ctx, out);
+  else
+    print_stats_text(ctx, out);
+  funlockfile(out);
+}
@@ -105,4 +105,139 @@ assert 5 'main() { x=3; y=&x; *y=5; return x; }'
 assert 7 'main() { x=3; y=5; *(&x+8)=7; return y; }'
 assert 7 'main() { x=3; y=5; *(&y-8)=7; return x; }'
 
+# 生存区間が重ならない変数はスロットを共有する。"&"を使う関数では共有しない
+assert 12 'main() { a=1; b=a+1; c=b+1; d=c+1; e=d+1; f=e+1; g=f+1; h=g+1; i=h+1; j=i+1; k=j+1; return k+1; }'
+assert 6 'main() { s=0; for (i=0; i<3; i=i+1) { t=i*2; s=s+t; } u=s; return u; }'
+./9cc --frame-report 'main() { a=1; b=a+1; c=b+1; return c; } f(x) { y=x; return *(&y+8); }' 2>&1 >/dev/null |
+  tr '\n' ' ' | grep -q 'frame main: 8 bytes.*frame f: 16 bytes.*address taken' || { echo "--frame-report failed"; exit 1; }
+
+# --statsの出力にフェーズとカウントが含まれているか
+./9cc --stats=json 'main() { return fib(9); } fib(x) { if (x<=1) return 1; return fib(x-1) + fib(x-2); }' 2>&1 >/dev/null |
+  grep -q '"counts":{"token":42,"node":19,"var":1,"varlist":2,"function":2' || { echo "--stats failed"; exit 1; }
+
+# 複数のファイルを-jで同時にコンパイルし、それぞれの.sを1つのバイナリにリンクする
+# （*.cはMakefileでビルド対象になるので、tmpdirの中に作る）
+mkdir -p tmpdir
+echo 'main() { return add2(sub2(9, 4), 2); }' > tmpdir/main.c
+echo 'add2(x,y) { return x+y; } sub2(x,y) { return x-y; }' > tmpdir/lib.c
+./9cc -j 2 tmpdir/main.c tmpdir/lib.c && gcc -o tmp tmpdir/main.s tmpdir/lib.s && ./tmp
+[ "$?" = 7 ] || { echo "-j failed"; exit 1; }
+# 開けない入力や出力、コンパイルエラーがあっても、そのファイルだけ失敗にして他のファイルはコンパイルする
+rm -f tmpdir/main.s tmpdir/lib.s && mkdir -p tmpdir/dir.s && echo 'main() { return 1; }' > tmpdir/dir.c
+echo 'main() { 1+; }' > tmpdir/bad.c
+! ./9cc -j 1 tmpdir/nonexistent.c tmpdir/dir.c tmpdir/bad.c tmpdir/main.c tmpdir/lib.c 2>/dev/null &&
+  [ -f tmpdir/main.s ] && [ -f tmpdir/lib.s ] && [ ! -f tmpdir/bad.s ] || { echo "-j with a failing file failed"; exit 1; }
+
+# 関数のシンボルに型と大きさがあり、行番号の情報から命令をソースの行へ対応付けられる
+printf 'main() {\n  return add(3,\n    4);\n}\nadd(a, b) {\n  return a + b;\n}\n' > tmpdir/loc.c
+./9cc tmpdir/loc.c > tmp.s && gcc -o tmp tmp.s && ./tmp
+[ "$?" = 7 ] && readelf -s tmp | grep -q 'FUNC *GLOBAL .* add$' &&
+  [ "$(readelf -s tmp | awk '$8 == "add" { print $3 }')" -gt 0 ] &&
+  addr2line -e tmp "$(nm tmp | awk '$3 == "add" { print $1 }')" | grep -q 'loc.c:5$' &&
+  readelf --debug-dump=frames tmp | grep -q 'DW_CFA_def_cfa_register: r6 (rbp)' || { echo "debug info failed"; exit 1; }
+
+# --pipelineでも通常のモードと同じアセンブリを出力する
+prog='main() { return fib(9); } fib(x) { if (x<=1) return 1; return fib(x-1) + fib(x-2); } f(x) { while (x) x=x-1; return x; }'
+./9cc --pipeline -j 3 "$prog" | cmp -s - <(./9cc "$prog") || { echo "--pipeline failed"; exit 1; }
+
+# --whole-programはmainと--exportの関数から呼び出されない関数を出力しない
+prog='main() { return even(4) + keep(1); } even(n) { if (n==0) return 1; return odd(n-1); } odd(n) { if (n==0) return 0; return even(n-1); } keep(x) { return x+1; } unused(x) { return keep(x); }'
+asm=$(./9cc --whole-program "$prog") && echo "$asm" | grep -q '^odd:' && ! echo "$asm" | grep -q '^unused:' &&
+  ./9cc --whole-program --export=unused "$prog" | grep -q '^unused:' &&
+  ! ./9cc --whole-program 'f() { return 1; }' 2>/dev/null &&
+  ./9cc --whole-program "$prog" > tmp.s && gcc -o tmp tmp.s && ./tmp
+[ "$?" = 3 ] || { echo "--whole-program failed"; exit 1; }
+
+# 呼び出しグラフの強連結成分の番号は呼び出される関数の方が小さく、互いに呼び出し合う関数は同じ番号になる
+graph='main() { return even(4) + fib(5) + a(1); } even(n) { if (n==0) return 1; return odd(n-1); } odd(n) { if (n==0) return 0; return even(n-1); } fib(x) { if (x<=1) return 1; return fib(x-1) + fib(x-2); } a(x) { return b(x); } b(x) { return c(x); } c(x) { return x; }'
+for mode in "" "--pipeline -j 2"; do
+  [ "$(./9cc --callgraph-report $mode "$graph" 2>&1 >/dev/null | sed 's/^callgraph \([a-z]*\): \(scc [0-9]*\(, recursive\)*\).*/\1 \2/' | tr '\n' ' ')" = \
+    "main scc 5 even scc 4, recursive odd scc 4, recursive fib scc 3, recursive a scc 2 b scc 1 c scc 0 " ] ||
+    { echo "--callgraph-report failed $mode"; exit 1; }
+done
+
+# --foldは純粋な関数の定数の引数での呼び出しをコンパイル時に評価する。ポインタを使う関数は評価しない
+prog='main() { return fib(9) + sq(sq(3)) + id(2); } fib(x) { if (x<=1) return 1; return fib(x-1) + fib(x-2); } sq(x) { return x*x; } id(x) { return *(&x); }'
+asm=$(./9cc --fold "$prog") && echo "$asm" | grep -q 'push 55' && echo "$asm" | grep -q 'call id' &&
+  ./9cc --fold --pipeline -j 2 "$prog" | cmp -s - <(echo "$asm") &&
+  echo "$asm" > tmp.s && gcc -o tmp tmp.s && ./tmp
+[ "$?" = 138 ] || { echo "--fold failed"; exit 1; }
+
+# --remarksは関数ごとの命令の数と、最適化を適用した箇所と見送った箇所を理由と一緒に出力する
+./9cc --fold --remarks "$prog" 2>&1 >/dev/null | tr '\n' ' ' |
+  grep -q '^-:1: main: 31 instructions (7 push, 7 pop), .* 1 calls, 1 alignment checks, scc 3 -:1:17: remark: fold: folded call to fib into 55 .*-:1:38: missed: fold: call to id not folded: id uses a pointer' &&
+  ./9cc --fold --remarks=json --pipeline -j 2 "$prog" 2>&1 >/dev/null | grep -q '^{"function":"fib","line":1,"instructions":75,"push":17,"pop":17,.*"calls":2,"alignment_checks":2,"scc":2,"recursive":true,"remarks":\[\]}$' &&
+  ./9cc --fold --remarks "$prog" 2>/dev/null | cmp -s - <(./9cc --fold "$prog") || { echo "--remarks failed"; exit 1; }
+
+# --interpはアセンブルせずにmain()を実行し、その戻り値で終了する
+./9cc --interp "$prog"
+[ "$?" = 138 ] || { echo "--interp failed"; exit 1; }
+./9cc --interp 'main() { x=3; y=5; *(&x+8)=7; return y; }'
+[ "$?" = 7 ] || { echo "--interp failed"; exit 1; }
+./9cc --interp 'main() { return 1/0; }' 2>&1 | grep -q 'division error' &&
+  ./9cc --interp --fuel=1000 'main() { while (1) 1; }' 2>&1 | grep -q 'out of fuel' || { echo "--interp failed"; exit 1; }
+
+# --streamは通常のモードと同じアセンブリを出力し、ピークのメモリ使用量は入力の大きさによらない
+big() {
+  seq "$1" | sed 's/.*/f&(a, b) { x = a + b * 3; if (x > 5) return x - b; y = x; while (y) y = y - 1; return x; }/'
+  echo 'main() { return f1(1, 2); }'
+}
+peak_rss() {
+  ./9cc --stream --stats=json tmpdir/big.c 2>&1 >/dev/null | sed -n 's/.*"peak_rss_kb":\([0-9]*\).*/\1/p'
+}
+big 1000 > tmpdir/big.c
+./9cc --stream tmpdir/big.c | cmp -s - <(./9cc tmpdir/big.c) || { echo "--stream failed"; exit 1; }
+small=$(peak_rss)
+big 50000 > tmpdir/big.c
+large=$(peak_rss)
+[ "$large" -lt $((small + 2048)) ] || { echo "--stream: peak RSS grew from ${small}KB to ${large}KB"; exit 1; }
+
+# 深くネストした入力でも、ネイティブのスタックを1MBに制限したままコンパイルできる
+# $1: 期待する終了コード、標準入力: プログラム
+assert_deep() {
+  cat > tmpdir/deep.c
+  (ulimit -s 1024; ./9cc tmpdir/deep.c > tmp.s) && gcc -o tmp tmp.s && ./tmp
+  actual="$?"
+  [ "$actual" = "$1" ] || { echo "deep nesting: $1 expected, but got $actual"; exit 1; }
+}
+
+repeat() {
+  yes "$1" | head -n "$2" | tr -d '\n'
+}
+
+{ printf 'main() { return '; repeat '(' 1000000; printf 7; repeat ')' 1000000; printf '; }'; } | assert_deep 7
+{ printf 'main() { '; repeat 'if (1) {' 200000; printf 'return 5;'; repeat '}' 200000; printf ' }'; } | assert_deep 5
+{ printf 'main() { return '; repeat '1+(' 100000; printf 0; repeat ')' 100000; printf '; }'; } | assert_deep 160
+./9cc --max-depth=100 "main() { return $(repeat '(' 200)1$(repeat ')' 200); }" 2>&1 >/dev/null |
+  grep -q 'nesting too deep' || { echo "--max-depth failed"; exit 1; }
+# --interpも再帰せずに評価するので、上限を超えるとクラッシュせずに失敗する
+(ulimit -s 1024; ./9cc --interp "main() { return $(repeat '1+(' 6000)0$(repeat ')' 6000); }")
+[ "$?" = 112 ] || { echo "deep --interp failed"; exit 1; }
+(ulimit -s 1024; ./9cc --interp "main() { return $(repeat '1+(' 20000)0$(repeat ')' 20000); }") 2>&1 |
+  grep -q 'nested too deep' || { echo "deep --interp failed"; exit 1; }
+echo "deep nesting => OK"
+
+# --serverはエラーのリクエストの後も次のリクエストを処理する
+res=$(printf 'compile 14\nmain() { 1+; }compile 20\nmain() { return 5; }' | ./9cc --server)
+echo "$res" | grep -q '^error ' && echo "$res" | grep -q '^ok ' || { echo "--server failed"; exit 1; }
+# オプションはリクエストごとに指定でき、--remarksなどの出力はreportとしてレスポンスに含める
+res=$(printf 'compile --fold --remarks 46\nmain() { return sq(3); } sq(x) { return x*x; }compile 20\nmain() { return 5; }' | ./9cc --server)
+echo "$res" | grep -q 'push 9' && echo "$res" | grep -q '^-:1:17: remark: fold: folded call to sq into 9$' &&
+  [ "$(echo "$res" | grep -c 'remark:')" = 1 ] && echo "$res" | grep -q '^ok [0-9]* [0-9]*$' &&
+  printf 'compile 99999999999999\n' | ./9cc --server | grep -q '^request too large$' &&
+  printf 'compile 100\nmain' | ./9cc --server | grep -q '^truncated request$' &&
+  printf 'compile --bogus 1\n;' | ./9cc --server | grep -q '^unknown option: --bogus$' || { echo "--server options failed"; exit 1; }
+
+# Unixドメインソケット経由でtools/9cc-clientからコンパイルする
+./9cc --server=tmp.sock &
+server=$!
+for i in $(seq 50); do [ -S tmp.sock ] && break; sleep 0.1; done
+./tools/9cc-client tmp.sock 'main() { return add(2, 4); } add(x,y) { return x+y; }' > tmp.s &&
+  ! ./tools/9cc-client tmp.sock 'main() { return; }' 2>/dev/null &&
+  ./tools/9cc-client tmp.sock --stats 'main() { a=1; return a; }' 2>&1 >/dev/null | grep -q '^  total ' &&
+  gcc -o tmp tmp.s && ./tmp
+actual="$?"
+kill $server
+[ "$actual" = 6 ] || { echo "9cc-client failed"; exit 1; }
+
 echo OK
\ No newline at end of file
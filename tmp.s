@@ -0,0 +1,76 @@
+.intel_syntax noprefix
+.file "-"
+.file 1 "-"
+.global main
+.type main, @function
+main:
+  .cfi_startproc
+  .loc 1 1
+  push rbp
+  .cfi_def_cfa_offset 16
+  .cfi_offset rbp, -16
+  mov rbp, rsp
+  .cfi_def_cfa_register rbp
+  sub rsp, 0
+  push 2
+  push 4
+  pop rsi
+  pop rdi
+  mov rax, rsp
+  and rax, 15
+  jnz .Lcall.main.0
+  mov rax, 0
+  call add
+  jmp .Lend.main.0
+.Lcall.main.0:
+  sub rsp, 8
+  mov rax, 0
+  call add
+  add rsp, 8
+.Lend.main.0:
+  push rax
+  pop rax
+  jmp .Lreturn.main
+.Lreturn.main:
+  mov rsp, rbp
+  pop rbp
+  .cfi_def_cfa rsp, 8
+  ret
+  .cfi_endproc
+.size main, .-main
+.global add
+.type add, @function
+add:
+  .cfi_startproc
+  .loc 1 1
+  push rbp
+  .cfi_def_cfa_offset 16
+  .cfi_offset rbp, -16
+  mov rbp, rsp
+  .cfi_def_cfa_register rbp
+  sub rsp, 16
+  mov [rbp-16], rdi
+  mov [rbp-8], rsi
+  lea rax, [rbp-16]
+  push rax
+  pop rax
+  mov rax, [rax]
+  push rax
+  lea rax, [rbp-8]
+  push rax
+  pop rax
+  mov rax, [rax]
+  push rax
+  pop rdi
+  pop rax
+  add rax, rdi
+  push rax
+  pop rax
+  jmp .Lreturn.add
+.Lreturn.add:
+  mov rsp, rbp
+  pop rbp
+  .cfi_def_cfa rsp, 8
+  ret
+  .cfi_endproc
+.size add, .-add
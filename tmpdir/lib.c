@@ -0,0 +1 @@
+add2(x,y) { return x+y; } sub2(x,y) { return x-y; }
@@ -0,0 +1,7 @@
+main() {
+  return add(3,
+    4);
+}
+add(a, b) {
+  return a + b;
+}
@@ -0,0 +1 @@
+main() { return add2(sub2(9, 4), 2); }
@@ -0,0 +1,56 @@
+.intel_syntax noprefix
+.file "tmpdir/main.c"
+.file 1 "tmpdir/main.c"
+.global main
+.type main, @function
+main:
+  .cfi_startproc
+  .loc 1 1
+  push rbp
+  .cfi_def_cfa_offset 16
+  .cfi_offset rbp, -16
+  mov rbp, rsp
+  .cfi_def_cfa_register rbp
+  sub rsp, 0
+  push 9
+  push 4
+  pop rsi
+  pop rdi
+  mov rax, rsp
+  and rax, 15
+  jnz .Lcall.main.0
+  mov rax, 0
+  call sub2
+  jmp .Lend.main.0
+.Lcall.main.0:
+  sub rsp, 8
+  mov rax, 0
+  call sub2
+  add rsp, 8
+.Lend.main.0:
+  push rax
+  push 2
+  pop rsi
+  pop rdi
+  mov rax, rsp
+  and rax, 15
+  jnz .Lcall.main.1
+  mov rax, 0
+  call add2
+  jmp .Lend.main.1
+.Lcall.main.1:
+  sub rsp, 8
+  mov rax, 0
+  call add2
+  add rsp, 8
+.Lend.main.1:
+  push rax
+  pop rax
+  jmp .Lreturn.main
+.Lreturn.main:
+  mov rsp, rbp
+  pop rbp
+  .cfi_def_cfa rsp, 8
+  ret
+  .cfi_endproc
+.size main, .-main
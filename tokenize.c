@@ -1,117 +1,153 @@
 #include "9cc.h"
 
-// 9cc.hに宣言されたグローバル変数をここで定義
-char *user_input;
-Token *token;
-
 // エラーを報告する関数
 void error(char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
+  flockfile(stderr); // 他のスレッドのエラー出力と混ざらないようにする。終了するので解放しない
   vfprintf(stderr, fmt, ap);
   fprintf(stderr, "\n");
   exit(1);
 }
 
-// エラー箇所を報告し、プロセスを終了する
-void verror_at(char *loc, char *fmt, va_list ap) {
-  int pos = loc - user_input;
-  fprintf(stderr, "%s\n", user_input);
-  fprintf(stderr, "%*s", pos, ""); // print pos spaces.
-  fprintf(stderr, "^ ");
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
+// エラーを報告した後の処理
+// ctx->on_errorがあればそこへ戻り、なければプロセスを終了する
+static void bail(Ctx *ctx) {
+  if (ctx->on_error) {
+    funlockfile(ctx->err);
+    longjmp(*ctx->on_error, 1);
+  }
   exit(1);
 }
 
-// エラー箇所を報告し、プロセスを終了する
-void error_at(char *loc, char *fmt, ...) {
+// エラー箇所を報告する
+// 入力が複数行の場合は、locを含む行だけを表示する
+// ファイルから読み込んだ入力の場合は、先頭にファイル名と行番号を表示する
+static void verror_at(Ctx *ctx, char *loc, char *fmt, va_list ap) {
+  char *line = loc;
+  while (ctx->user_input < line && line[-1] != '\n')
+    line--;
+  char *end = loc;
+  while (*end && *end != '\n')
+    end++;
+
+  flockfile(ctx->err);
+  int indent = 0;
+  if (ctx->filename) {
+    int line_no = 1;
+    for (char *p = ctx->user_input; p < line; p++)
+      if (*p == '\n')
+        line_no++;
+    indent = fprintf(ctx->err, "%s:%d: ", ctx->filename, line_no);
+  }
+
+  int pos = loc - line + indent;
+  fprintf(ctx->err, "%.*s\n", (int)(end - line), line);
+  fprintf(ctx->err, "%*s", pos, ""); // print pos spaces.
+  fprintf(ctx->err, "^ ");
+  vfprintf(ctx->err, fmt, ap);
+  fprintf(ctx->err, "\n");
+  bail(ctx);
+}
+
+// エラー箇所を報告する
+void error_at(Ctx *ctx, char *loc, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(loc, fmt, ap);
+  verror_at(ctx, loc, fmt, ap);
 }
 
-// エラー箇所を報告し、プロセスを終了する
-void error_tok(Token *tok, char *fmt, ...) {
+// エラー箇所を報告する
+void error_tok(Ctx *ctx, Token *tok, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
   if (tok)
-    verror_at(tok->str, fmt, ap);
+    verror_at(ctx, tok->str, fmt, ap);
 
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
-  exit(1);
+  flockfile(ctx->err);
+  vfprintf(ctx->err, fmt, ap);
+  fprintf(ctx->err, "\n");
+  bail(ctx);
 }
 
 // str.strndupと同様の振る舞いをするメソッド
-char *my_strndup(char *p, int len) {
-  char *buf = malloc(len + 1);
+char *my_strndup(Ctx *ctx, char *p, int len) {
+  char *buf = new_obj(ctx, AL_STRING, len + 1);
   strncpy(buf, p, len);
   buf[len] = '\0';
   return buf;
 }
 
+static Token *read_token(Ctx *ctx);
+
+// 次のトークンへ進む。tokenize_lazyの場合は、まだ読んでいなければここで読む
+static void advance(Ctx *ctx) {
+  if (!ctx->token->next && ctx->token->kind != TK_EOF)
+    ctx->token->next = read_token(ctx);
+  ctx->token = ctx->token->next;
+}
+
 // 次のトークンが期待する記号の時は、トークンを1つ進めてtrueを返す。
 // それ以外はfalseを返す
-Token *consume(char *op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len || 
-        memcmp(token->str, op, token->len))
+Token *consume(Ctx *ctx, char *op) {
+  if (ctx->token->kind != TK_RESERVED || strlen(op) != ctx->token->len || 
+        memcmp(ctx->token->str, op, ctx->token->len))
       return NULL;
-  Token *t = token;
-  token = token->next;
+  Token *t = ctx->token;
+  advance(ctx);
   return t;
 }
 
 // TK_IDENTを確認する
-Token *consume_ident() {
-  if (token->kind != TK_IDENT)
+Token *consume_ident(Ctx *ctx) {
+  if (ctx->token->kind != TK_IDENT)
     return NULL;
-  Token *t = token;
-  token = token->next;
+  Token *t = ctx->token;
+  advance(ctx);
   return t;
 }
 
 // 次のトークンが期待する記号の時は、トークンを1つ読み進める。
 // それ以外の場合はエラーを報告する。
-void expect(char *op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len || 
-        memcmp(token->str, op, token->len))
-    error_tok(token, "expected \"%s\"", op);
-  token = token->next;
+void expect(Ctx *ctx, char *op) {
+  if (ctx->token->kind != TK_RESERVED || strlen(op) != ctx->token->len || 
+        memcmp(ctx->token->str, op, ctx->token->len))
+    error_tok(ctx, ctx->token, "expected \"%s\"", op);
+  advance(ctx);
 }
 
 // 次のトークンが数値の時は、トークンを1つ読み進めてその数値を返す。
 // それ以外の場合はエラーを報告する。
-int expect_number() {
-  if (token->kind != TK_NUM) {
-    error_tok(token, "expected a number");
+int expect_number(Ctx *ctx) {
+  if (ctx->token->kind != TK_NUM) {
+    error_tok(ctx, ctx->token, "expected a number");
   }
-  int val = token->val;
-  token = token->next;
+  int val = ctx->token->val;
+  advance(ctx);
   return val;
 }
 
 // 現在のトークンがTK_IDENTかどうか確認し、TK_IDENTなら１つ進める
-char *expect_ident() {
-  if (token->kind != TK_IDENT)
-    error_tok(token, "expect an identifier");
-  char *s = my_strndup(token->str, token->len);
-  token = token->next;
+char *expect_ident(Ctx *ctx) {
+  if (ctx->token->kind != TK_IDENT)
+    error_tok(ctx, ctx->token, "expect an identifier");
+  char *s = my_strndup(ctx, ctx->token->str, ctx->token->len);
+  advance(ctx);
   return s;
 }
 
 // EOFかどうか
-bool at_eof() {
-  return token->kind == TK_EOF;
+bool at_eof(Ctx *ctx) {
+  return ctx->token->kind == TK_EOF;
 }
 
-// 新しいトークンを作成してcurに繋げる
-static Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token));
+// 新しいトークンを作成する。行番号は読み込み中の行にする
+static Token *new_token(Ctx *ctx, TokenKind kind, char *str, int len) {
+  Token *tok = new_obj(ctx, AL_TOKEN, sizeof(Token));
   tok->kind = kind;
   tok->str = str;
   tok->len = len;
-  cur->next = tok;
+  tok->line_no = ctx->tok_line;
   return tok;
 }
 
@@ -150,57 +186,73 @@ static char *starts_with_reserved(char *p) {
   return NULL;
 } 
 
-// 入力文字列（user_input）をトークナイズして、新しいトークンを返却する
-Token *tokenize() {
-  char *p = user_input;
-  // 最初のトークンを初期化
-  Token head;
-  head.next = NULL;
-  Token *cur = &head;
+// ctx->tok_posから次のトークンを1つ読んで返す。入力の終わりではTK_EOFを返す
+static Token *read_token(Ctx *ctx) {
+  char *p = ctx->tok_pos;
 
   while (*p) {
     // 空白の場合読み飛ばす
     if (isspace(*p)) {
+      if (*p == '\n')
+        ctx->tok_line++;
       p++;
       continue;
     }
 
+    Token *tok;
+
     // キーワード or 2文字の演算子かどうか判定
     char *kw = starts_with_reserved(p);
     if (kw) {
       int len = strlen(kw);
-      cur = new_token(TK_RESERVED, cur, p, len);
+      tok = new_token(ctx, TK_RESERVED, p, len);
       p += len;
-      continue;
-    }
-
-    // 1文字の区切り文字の場合
-    if (ispunct(*p)) {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
-      continue;
-    }
-
-    // 1文字の変数
-    if (is_alpha(*p)) {
+    } else if (ispunct(*p)) {
+      // 1文字の区切り文字の場合
+      tok = new_token(ctx, TK_RESERVED, p++, 1);
+    } else if (is_alpha(*p)) {
+      // 1文字の変数
       char *q = p++;
       while (is_alnum(*p))
         p++;
-      cur = new_token(TK_IDENT, cur, q, p - q);
-      continue;
-    }
-
-    // 数値の場合
-    if (isdigit(*p)) {
-      cur = new_token(TK_NUM, cur, p, 0);
+      tok = new_token(ctx, TK_IDENT, q, p - q);
+    } else if (isdigit(*p)) {
+      // 数値の場合
+      tok = new_token(ctx, TK_NUM, p, 0);
       char *q = p;
-      cur->val = strtol(p, &p, 10);
-      cur->len = p - q;
-      continue;
+      tok->val = strtol(p, &p, 10);
+      tok->len = p - q;
+    } else {
+      error_at(ctx, p, "invalid token");
     }
 
-    error_at(p, "invalid token");
+    ctx->tok_pos = p;
+    return tok;
   }
 
-  new_token(TK_EOF, cur, p , 0);
+  ctx->tok_pos = p;
+  return new_token(ctx, TK_EOF, p, 0);
+}
+
+// 入力文字列（user_input）をトークナイズして、新しいトークンを返却する
+Token *tokenize(Ctx *ctx) {
+  ctx->tok_pos = ctx->user_input;
+  ctx->tok_line = 1;
+
+  // 最初のトークンを初期化
+  Token head;
+  head.next = NULL;
+  Token *cur = &head;
+  do {
+    cur = cur->next = read_token(ctx);
+  } while (cur->kind != TK_EOF);
   return head.next;
-}
\ No newline at end of file
+}
+
+// 入力の最初のトークンだけを読んで返す。
+// 以降のトークンは、パースで次のトークンが必要になった時に1つずつ読む
+Token *tokenize_lazy(Ctx *ctx) {
+  ctx->tok_pos = ctx->user_input;
+  ctx->tok_line = 1;
+  return read_token(ctx);
+}
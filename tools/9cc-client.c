@@ -0,0 +1,105 @@
+// 9cc --server=PATHで起動したコンパイルサーバにコンパイルを依頼する
+//
+// usage: 9cc-client <socket-path> [option...] <program | file.c | ->
+//
+// optionは--statsなど9ccのコンパイルごとのオプションで、そのままリクエストに付けて送る。
+// 成功したらアセンブリを標準出力へ、失敗したらエラーメッセージを標準エラー出力へ書き出し、
+// 終了コード1で終了する。--statsなどの出力は標準エラー出力へ書き出す。
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void error(char *fmt, char *arg) {
+  fprintf(stderr, "9cc-client: ");
+  fprintf(stderr, fmt, arg);
+  fprintf(stderr, "\n");
+  exit(2);
+}
+
+// fpの中身を全て読み込んで返す
+static char *read_all(FILE *fp, size_t *len) {
+  char *buf;
+  FILE *out = open_memstream(&buf, len);
+  char tmp[4096];
+  size_t n;
+  while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0)
+    fwrite(tmp, 1, n, out);
+  fclose(out);
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <socket-path> [option...] <program | file.c | ->\n", argv[0]);
+    return 2;
+  }
+
+  // 9ccと同じく、"-"か".c"で終わる引数はファイルとして読む
+  char *arg = argv[argc - 1];
+  char *filename = NULL;
+  char *src = arg;
+  size_t len = strlen(arg);
+  if (!strcmp(arg, "-")) {
+    src = read_all(stdin, &len);
+  } else if (len > 2 && !strcmp(arg + len - 2, ".c")) {
+    FILE *fp = fopen(arg, "r");
+    if (!fp)
+      error("cannot open %s", arg);
+    src = read_all(fp, &len);
+    fclose(fp);
+    filename = arg;
+  }
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(argv[1]) >= sizeof(addr.sun_path))
+    error("%s: socket path too long", argv[1]);
+  strcpy(addr.sun_path, argv[1]);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    error("cannot connect to %s", argv[1]);
+
+  FILE *out = fdopen(dup(fd), "w");
+  fprintf(out, "compile");
+  for (int i = 2; i < argc - 1; i++)
+    fprintf(out, " %s", argv[i]);
+  if (filename)
+    fprintf(out, " file=%s", filename);
+  fprintf(out, " %zu\n", len);
+  fwrite(src, 1, len, out);
+  fclose(out);
+  shutdown(fd, SHUT_WR);
+
+  // レスポンスのヘッダを読み、本文をそのまま書き出す。reportがあれば標準エラー出力へ書き出す
+  FILE *in = fdopen(fd, "r");
+  char status[16];
+  size_t body_len;
+  size_t report_len = 0;
+  if (fscanf(in, "%15s %zu", status, &body_len) != 2)
+    error("invalid response from %s", argv[1]);
+  int c = fgetc(in);
+  if (c == ' ' && fscanf(in, "%zu", &report_len) == 1)
+    c = fgetc(in);
+  if (c != '\n')
+    error("invalid response from %s", argv[1]);
+
+  char *body = malloc(body_len);
+  char *report = malloc(report_len);
+  if (fread(body, 1, body_len, in) != body_len || fread(report, 1, report_len, in) != report_len)
+    error("truncated response from %s", argv[1]);
+  fclose(in);
+  fwrite(report, 1, report_len, stderr);
+
+  if (!strcmp(status, "ok")) {
+    fwrite(body, 1, body_len, stdout);
+    return 0;
+  }
+  fwrite(body, 1, body_len, stderr);
+  return 1;
+}